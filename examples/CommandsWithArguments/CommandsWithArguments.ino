@@ -70,7 +70,7 @@ Command commands[] {
   COMMAND(cmd_led_off, "off", ARG(ArgType::Int, START_PIN, END_PIN, "pin"), NULL, "turn off the led on the given pin"),
 };
 
-SerialCommands serialCommands(Serial, commands, sizeof(commands) / sizeof(Command));
+SerialCommands serialCommands = SERIAL_COMMANDS(Serial, commands);
 
 // if default buffer size (64) is too small pass a buffer through constructor
 // char buffer[128];
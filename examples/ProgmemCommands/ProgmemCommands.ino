@@ -0,0 +1,72 @@
+/*---------------------------------------------------------------------
+Author         : naszly
+License        : BSD
+Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
+-----------------------------------------------------------------------*/
+
+#include <StaticSerialCommands.h>
+
+void cmd_help(SerialCommands& sender, Args& args);
+void cmd_calc(SerialCommands& sender, Args& args);
+void cmd_calc_add(SerialCommands& sender, Args& args);
+void cmd_calc_mul(SerialCommands& sender, Args& args);
+
+/*
+PGM_COMMAND macro is used to define a named Command object for tables in program memory.
+It takes the name of the object followed by the arguments of COMMAND:
+    PGM_COMMAND(name, function, command)
+    PGM_COMMAND(name, function, command, subcommands)
+    PGM_COMMAND(name, function, command, subcommands, description)
+    PGM_COMMAND(name, function, command, arguments..., subcommands, description)
+Commands and tables have to be defined before they are used.
+PGM_COMMAND_TABLE defines a table in program memory and checks at compile time
+that the names of its commands are distinct. Subcommands of a PGM_COMMAND have to be
+such a table. It also defines table_footprint, the memory used by the table and its subtables.
+*/
+
+PGM_COMMAND(cmdCalcAdd, cmd_calc_add, "+", ArgType::Int, nullptr, "add numbers");
+PGM_COMMAND(cmdCalcMul, cmd_calc_mul, "*", ArgType::Int, nullptr, "multiply numbers");
+
+PGM_COMMAND_TABLE(subCommands, cmdCalcAdd, cmdCalcMul);
+
+PGM_COMMAND(cmdHelp, cmd_help, "help", nullptr, "list commands");
+PGM_COMMAND(cmdCalc, cmd_calc, "calc", ArgType::Int, subCommands, "calculator");
+
+PGM_COMMAND_TABLE(commands, cmdHelp, cmdCalc);
+
+// the tree fails to compile if it outgrows its budget
+static_assert(commands_footprint.flashBytes <= 512, "command tree takes too much flash");
+static_assert(SerialCommands::getRamBytes(commands_footprint) <= 1024, "command tree takes too much RAM");
+
+// the command tree takes no dynamic memory, the arguments of a line are allocated by the first readSerial
+SerialCommands serialCommands = PGM_SERIAL_COMMANDS(Serial, commands);
+
+void setup() {
+    Serial.begin(9600);
+
+    serialCommands.listAllCommands();
+}
+
+void loop() {
+    serialCommands.readSerial();
+}
+
+void cmd_help(SerialCommands& sender, Args& args) {
+    sender.listAllCommands();
+}
+
+void cmd_calc(SerialCommands& sender, Args& args) {
+    sender.listAllCommands(subCommands);
+}
+
+void cmd_calc_add(SerialCommands& sender, Args& args) {
+    auto number1 = args[0].getInt();
+    auto number2 = args[1].getInt();
+    sender.getSerial().println(number1 + number2);
+}
+
+void cmd_calc_mul(SerialCommands& sender, Args& args) {
+    auto number1 = args[0].getInt();
+    auto number2 = args[1].getInt();
+    sender.getSerial().println(number1 * number2);
+}
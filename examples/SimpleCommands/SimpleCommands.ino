@@ -28,7 +28,7 @@ Command commands[] {
   COMMAND(cmd_led_off, "off"),
 };
 
-SerialCommands serialCommands(Serial, commands, sizeof(commands) / sizeof(Command));
+SerialCommands serialCommands = SERIAL_COMMANDS(Serial, commands);
 
 // if default buffer size (64) is too small pass a buffer through constructor
 // char buffer[128];
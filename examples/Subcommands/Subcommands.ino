@@ -30,7 +30,7 @@ Command commands[] {
         COMMAND(cmd_calc, "calc", ArgType::Int, subCommands, "calculator"),
 };
 
-SerialCommands serialCommands(Serial, commands, sizeof(commands) / sizeof(Command));
+SerialCommands serialCommands = SERIAL_COMMANDS(Serial, commands);
 
 // if default buffer size (64) is too small pass a buffer through constructor
 // char buffer[128];
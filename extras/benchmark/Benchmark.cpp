@@ -0,0 +1,829 @@
+/*---------------------------------------------------------------------
+Author         : naszly
+License        : BSD
+Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
+-----------------------------------------------------------------------*/
+
+// Host benchmark for SerialCommands::readSerial and the line parser.
+// Usage: benchmark [filter]  - runs the workloads whose name contains filter
+// The exit code is 1 if a check of a workload failed, the failed checks are printed to stderr.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <random>
+
+#include "StaticSerialCommands.h"
+#include "Parse.h"
+#include "MockStream.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static uint32_t handled = 0;
+static size_t failedChecks = 0;
+
+static void check(const char* workload, bool passed, const char* what) {
+  if (!passed) {
+    fprintf(stderr, "FAILED %s: %s\n", workload, what);
+    failedChecks++;
+  }
+}
+
+void cmd_count(SerialCommands& sender, Args& args) {
+  handled++;
+}
+
+// flat table
+
+#define FLAT_COMMAND(n) COMMAND(cmd_count, "command" #n, nullptr, "flat command " #n)
+
+#define FLAT_COMMANDS_10(d) \
+  FLAT_COMMAND(d##0), FLAT_COMMAND(d##1), FLAT_COMMAND(d##2), FLAT_COMMAND(d##3), FLAT_COMMAND(d##4), \
+  FLAT_COMMAND(d##5), FLAT_COMMAND(d##6), FLAT_COMMAND(d##7), FLAT_COMMAND(d##8), FLAT_COMMAND(d##9)
+
+Command flatCommands[] {
+  FLAT_COMMANDS_10(7), FLAT_COMMANDS_10(3), FLAT_COMMANDS_10(5), FLAT_COMMANDS_10(1),
+  FLAT_COMMANDS_10(6), FLAT_COMMANDS_10(2), FLAT_COMMANDS_10(4), FLAT_COMMANDS_10(8),
+};
+
+// the same table in program memory, indexed at compile time
+
+#define FLAT_PGM_COMMAND(n) PGM_COMMAND(flatPgm##n, cmd_count, "command" #n, nullptr, "flat command " #n)
+
+#define FLAT_PGM_COMMANDS_10(d) \
+  FLAT_PGM_COMMAND(d##0); FLAT_PGM_COMMAND(d##1); FLAT_PGM_COMMAND(d##2); FLAT_PGM_COMMAND(d##3); FLAT_PGM_COMMAND(d##4); \
+  FLAT_PGM_COMMAND(d##5); FLAT_PGM_COMMAND(d##6); FLAT_PGM_COMMAND(d##7); FLAT_PGM_COMMAND(d##8); FLAT_PGM_COMMAND(d##9)
+
+#define FLAT_PGM_ENTRIES_10(d) \
+  flatPgm##d##0, flatPgm##d##1, flatPgm##d##2, flatPgm##d##3, flatPgm##d##4, \
+  flatPgm##d##5, flatPgm##d##6, flatPgm##d##7, flatPgm##d##8, flatPgm##d##9
+
+FLAT_PGM_COMMANDS_10(7); FLAT_PGM_COMMANDS_10(3); FLAT_PGM_COMMANDS_10(5); FLAT_PGM_COMMANDS_10(1);
+FLAT_PGM_COMMANDS_10(6); FLAT_PGM_COMMANDS_10(2); FLAT_PGM_COMMANDS_10(4); FLAT_PGM_COMMANDS_10(8);
+
+PGM_COMMAND_TABLE(flatPgmCommands,
+  FLAT_PGM_ENTRIES_10(7), FLAT_PGM_ENTRIES_10(3), FLAT_PGM_ENTRIES_10(5), FLAT_PGM_ENTRIES_10(1),
+  FLAT_PGM_ENTRIES_10(6), FLAT_PGM_ENTRIES_10(2), FLAT_PGM_ENTRIES_10(4), FLAT_PGM_ENTRIES_10(8));
+
+// deep subcommand tree
+
+Command deepLevel4[] {
+  COMMAND(cmd_count, "value", ARG(ArgType::Int, 0, 1000, "value"), nullptr, "set value"),
+  COMMAND(cmd_count, "list", nullptr, "list values"),
+};
+
+Command deepLevel3[] {
+  COMMAND(cmd_count, "channel", ARG(ArgType::Int, 0, 15, "channel"), deepLevel4, "select channel"),
+  COMMAND(cmd_count, "reset", nullptr, "reset device"),
+};
+
+Command deepLevel2[] {
+  COMMAND(cmd_count, "device", ArgType::Int, deepLevel3, "select device"),
+  COMMAND(cmd_count, "bus", nullptr, "bus status"),
+};
+
+Command deepCommands[] {
+  COMMAND(cmd_count, "system", deepLevel2, "system commands"),
+  COMMAND(cmd_count, "status", nullptr, "print status"),
+};
+
+// the same tree in program memory
+
+PGM_COMMAND(pgmValue, cmd_count, "value", ARG(ArgType::Int, 0, 1000, "value"), nullptr, "set value");
+PGM_COMMAND(pgmList, cmd_count, "list", nullptr, "list values");
+PGM_COMMAND_TABLE(pgmLevel4, pgmValue, pgmList);
+
+PGM_COMMAND(pgmChannel, cmd_count, "channel", ARG(ArgType::Int, 0, 15, "channel"), pgmLevel4, "select channel");
+PGM_COMMAND(pgmReset, cmd_count, "reset", nullptr, "reset device");
+PGM_COMMAND_TABLE(pgmLevel3, pgmChannel, pgmReset);
+
+PGM_COMMAND(pgmDevice, cmd_count, "device", ArgType::Int, pgmLevel3, "select device");
+PGM_COMMAND(pgmBus, cmd_count, "bus", nullptr, "bus status");
+PGM_COMMAND_TABLE(pgmLevel2, pgmDevice, pgmBus);
+
+PGM_COMMAND(pgmSystem, cmd_count, "system", pgmLevel2, "system commands");
+PGM_COMMAND(pgmStatus, cmd_count, "status", nullptr, "print status");
+PGM_COMMAND_TABLE(pgmDeepCommands, pgmSystem, pgmStatus);
+
+// many arguments, quoted strings and errors
+
+Command argCommands[] {
+  COMMAND(cmd_count, "set",
+          ArgType::Int, ArgType::Int, ArgType::Int, ArgType::Int,
+          ArgType::Int, ArgType::Int, ArgType::Int, ArgType::Int,
+          ArgType::Float, ArgType::Float, ArgType::Float, ArgType::Float,
+          ArgType::Float, ArgType::Float, ArgType::Float, ArgType::Float,
+          nullptr, "sixteen arguments"),
+  COMMAND(cmd_count, "say", ArgType::String, ArgType::String, nullptr, "two strings"),
+  COMMAND(cmd_count, "pwm", ARG(ArgType::Int, 0, 13, "pin"), ARG(ArgType::Int, 0, 255, "duty"), nullptr, "set pwm"),
+};
+
+// a calibration table in one line
+
+Command bulkCommands[] {
+  COMMAND(cmd_count, "cal", ARG(ArgType::Int, 0, 7, "table"), ARG_VARIADIC(64, ArgType::Float, -10, 10, "coefficient"), nullptr, "load calibration"),
+};
+
+// a command function that takes 20 us
+
+void cmd_sweep(SerialCommands& sender, Args& args) {
+  Clock::time_point end = Clock::now() + std::chrono::microseconds(20);
+  while (Clock::now() < end) {}
+  handled++;
+}
+
+Command slowCommands[] {
+  COMMAND(cmd_sweep, "sweep", ARG(ArgType::Int, 0, 100, "steps"), nullptr, "slow command"),
+};
+
+// runs on the executing thread of the pipeline workload
+
+static std::atomic<uint32_t> pipelined(0);
+
+void cmd_pipelined(SerialCommands& sender, Args& args) {
+  pipelined++;
+}
+
+Command pipelineCommands[] {
+  COMMAND(cmd_pipelined, "pwm", ARG(ArgType::Int, 0, 13, "pin"), ARG(ArgType::Int, 0, 255, "duty"), nullptr, "set pwm"),
+};
+
+// A simulated link sends lines at full rate into a ReceiveRing, one byte per tick,
+// as a receive interrupt would. It keeps sending while a command runs for 40 ticks.
+// Throttled by XOFF or the RTS callback, the sender stops 16 bytes later.
+
+struct FlowLink {
+  ReceiveRing* ring;
+  std::string input;
+  size_t position = 0;
+  size_t ticks = 0;
+  bool stopped = false;
+  size_t inFlight = 0;  // bytes still sent after the stop
+
+  void tick(size_t count) {
+    for (; count > 0 && position < input.size(); --count) {
+      ticks++;
+      if (stopped && inFlight == 0) continue;
+      if (stopped) inFlight--;
+      ring->push(input[position++]);
+    }
+  }
+
+  void throttle(bool stop) {
+    if (stop && !stopped) inFlight = 16;
+    stopped = stop;
+  }
+};
+
+static FlowLink* flowLink;
+static std::vector<bool> flowReceived;
+
+void cmd_flow(SerialCommands& sender, Args& args) {
+  int32_t sequence = args[0].getInt();
+  if (sequence >= 0 && (size_t) sequence < flowReceived.size()) {
+    flowReceived[sequence] = true;
+  }
+  flowLink->tick(40);
+}
+
+Command flowCommands[] {
+  COMMAND(cmd_flow, "seq", ARG(ArgType::Int, "sequence"), nullptr, "numbered command"),
+};
+
+// the receiver's output, XON and XOFF reach the sender at once
+class FlowStream : public MockStream {
+  public:
+    size_t write(uint8_t c) override {
+      if (c == CMD_XOFF || c == CMD_XON) flowLink->throttle(c == CMD_XOFF);
+      return MockStream::write(c);
+    }
+    using MockStream::write;
+};
+
+struct Result {
+  double commandsPerSecond;
+  double nsPerByte;
+  double p50;
+  double p99;
+  double outputPerCommand;
+};
+
+static std::string joinLines(const std::vector<std::string>& lines, size_t count) {
+  std::string input;
+  for (size_t i = 0; i < count; ++i) {
+    input += lines[i % lines.size()];
+    input += '\n';
+  }
+  return input;
+}
+
+static std::string encodeFrame(const std::vector<uint8_t>& payload) {
+  std::string frame;
+  frame += (char) CMD_FRAME_SYNC;
+  frame += (char) payload.size();
+  frame.append(payload.begin(), payload.end());
+  uint16_t crc = frame::crc16((const uint8_t*) frame.data() + 1, payload.size() + 1);
+  frame += (char) (crc >> 8);
+  frame += (char) crc;
+  return frame;
+}
+
+static double elapsedNs(Clock::time_point begin, Clock::time_point end) {
+  return std::chrono::duration<double, std::nano>(end - begin).count();
+}
+
+static Result run(SerialCommands& serialCommands, MockStream& stream, const std::vector<std::string>& lines, size_t count) {
+  Result result;
+
+  // throughput: everything is available at once
+  std::string input = joinLines(lines, count);
+  stream.setInput(input);
+  stream.clearOutput();
+  Clock::time_point begin = Clock::now();
+  while (stream.available() > 0) {
+    serialCommands.readSerial();
+  }
+  double ns = elapsedNs(begin, Clock::now());
+  result.commandsPerSecond = count / (ns / 1e9);
+  result.nsPerByte = ns / input.size();
+  result.outputPerCommand = (double)stream.getOutputSize() / count;
+
+  // latency: one line per readSerial call
+  std::vector<double> samples;
+  samples.reserve(count / 10);
+  for (size_t i = 0; i < count / 10; ++i) {
+    std::string line = lines[i % lines.size()] + '\n';
+    stream.setInput(line);
+    begin = Clock::now();
+    serialCommands.readSerial();
+    samples.push_back(elapsedNs(begin, Clock::now()));
+  }
+  std::sort(samples.begin(), samples.end());
+  result.p50 = samples[samples.size() / 2];
+  result.p99 = samples[samples.size() * 99 / 100];
+  return result;
+}
+
+// command to handler latency: the line arrives in chunks, only the
+// readSerial call that receives the terminator is measured
+static void runStreamed(const char* name, SerialCommands& serialCommands, MockStream& stream, const std::vector<std::string>& lines, size_t count, size_t chunkSize) {
+  std::vector<double> samples;
+  samples.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    const std::string& line = lines[i % lines.size()];
+    for (size_t position = 0; position < line.size(); position += chunkSize) {
+      stream.setInput(line.data() + position, std::min(chunkSize, line.size() - position));
+      serialCommands.readSerial();
+    }
+    stream.setInput("\n");
+    Clock::time_point begin = Clock::now();
+    serialCommands.readSerial();
+    samples.push_back(elapsedNs(begin, Clock::now()));
+  }
+  std::sort(samples.begin(), samples.end());
+  printf("%-16s %14s %10s %10.0f %10.0f\n", name, "-", "-", samples[samples.size() / 2], samples[samples.size() * 99 / 100]);
+}
+
+// latency of the readSerial call that receives a line for a slow command,
+// queued commands run in poll after the measured call
+static void runSlow(const char* name, SerialCommands& serialCommands, MockStream& stream, size_t count) {
+  std::vector<double> samples;
+  samples.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    stream.setInput("sweep 5\n");
+    Clock::time_point begin = Clock::now();
+    serialCommands.readSerial();
+    samples.push_back(elapsedNs(begin, Clock::now()));
+    while (serialCommands.poll()) {}
+  }
+  std::sort(samples.begin(), samples.end());
+  printf("%-16s %14s %10s %10.0f %10.0f\n", name, "-", "-", samples[samples.size() / 2], samples[samples.size() * 99 / 100]);
+}
+
+// a producer thread pushes the input into a ReceiveRing in random chunks as fast as it can,
+// every command has to arrive without errors, full counts the pushes that found the ring full
+static void runRing(SerialCommands& serialCommands, MockStream& stream, const std::vector<std::string>& lines, size_t count) {
+  static uint8_t ringBuffer[256];
+  ReceiveRing ring(ringBuffer);
+  serialCommands.setReceiveRing(&ring);
+
+  std::string input = joinLines(lines, count);
+  stream.setCaptureOutput(true);
+  stream.clearOutput();
+  uint32_t before = handled;
+  size_t fullWaits = 0;
+
+  Clock::time_point begin = Clock::now();
+  std::thread producer([&]() {
+    std::mt19937 random(7);
+    size_t position = 0;
+    while (position < input.size()) {
+      uint16_t length = std::min<size_t>(1 + random() % 16, input.size() - position);
+      uint16_t pushed = ring.push((const uint8_t*) input.data() + position, length);
+      position += pushed;
+      if (pushed < length) {
+        // let the consumer run on single core machines
+        fullWaits++;
+        std::this_thread::yield();
+      }
+    }
+  });
+  while (handled - before < count) {
+    if (ring.available() == 0) {
+      std::this_thread::yield();
+    }
+    serialCommands.readSerial();
+  }
+  double ns = elapsedNs(begin, Clock::now());
+  producer.join();
+
+  size_t failed = stream.getOutput().find("ERROR") != std::string::npos ? 1 : 0;
+  printf("%-16s %14.0f %10.2f  full %zu, failed %zu\n", "ring", count / (ns / 1e9), ns / input.size(), fullWaits, failed);
+  check("ring", failed == 0, "no errors");
+  check("ring", handled - before == count && ring.available() == 0, "every command arrives once");
+  stream.setCaptureOutput(false);
+  serialCommands.setReceiveRing(nullptr);
+}
+
+// The main thread parses (readSerial) and sends the responses (drain), an executing
+// thread runs the queued commands (poll) and answers each with "OK" through the
+// PipelineStream. At most 16 lines are in flight, the queue holds more than 16 records.
+// Every command has to be answered without errors, a lost command ends the workload.
+static std::thread::id receivingThread;
+
+static void runPipeline(const std::vector<std::string>& lines, size_t count) {
+  static char lineBuffer[256];
+  static uint8_t queue[2048];
+  static uint8_t responseBuffer[256];
+  MockStream stream;
+  receivingThread = std::this_thread::get_id();
+  PipelineStream pipeline(stream, responseBuffer, []() { return std::this_thread::get_id() != receivingThread; });
+  SerialCommands serialCommands(pipeline, pipelineCommands, sizeof(pipelineCommands) / sizeof(Command), lineBuffer, sizeof(lineBuffer));
+  serialCommands.enableQueue(queue, sizeof(queue));
+  serialCommands.enableBatchStatus();
+  stream.setCaptureOutput(true);
+  pipelined = 0;
+
+  const size_t chunkLines = 8;
+  std::atomic<bool> done(false);
+  Clock::time_point begin = Clock::now();
+  std::thread executor([&]() {
+    while (!done) {
+      // let the receiving thread run on single core machines
+      if (!serialCommands.poll()) std::this_thread::yield();
+    }
+  });
+  size_t fed = 0;
+  std::string input;
+  bool lost = false;
+  while (pipelined < count && !lost) {
+    if (stream.available() == 0 && fed < count && fed - pipelined + chunkLines <= 16) {
+      size_t lineCount = std::min(chunkLines, count - fed);
+      input.clear();
+      for (size_t i = 0; i < lineCount; ++i) {
+        input += lines[(fed + i) % lines.size()];
+        input += '\n';
+      }
+      stream.setInput(input);
+      fed += lineCount;
+    }
+    serialCommands.readSerial();
+    pipeline.drain();
+    if (stream.available() == 0) {
+      // the fed lines are parsed, the counter is written before the queue is seen empty
+      lost = serialCommands.isQueueEmpty() && pipelined < fed;
+      std::this_thread::yield();
+    }
+  }
+  done = true;
+  executor.join();
+  double ns = elapsedNs(begin, Clock::now());
+  pipeline.drain();
+
+  const std::string& output = stream.getOutput();
+  size_t answered = 0;
+  for (size_t position = 0; (position = output.find("OK\r\n", position)) != std::string::npos; position += 4) {
+    answered++;
+  }
+  size_t failed = count - answered + (output.size() != answered * 4 ? 1 : 0);
+  printf("%-16s %14.0f %10s  failed %zu\n", "pipeline", count / (ns / 1e9), "-", failed);
+  check("pipeline", failed == 0, "every command is answered");
+}
+
+// every sequence number has to arrive, lost counts the missing ones,
+// link is the share of the ticks the sender could send, flow control must not lose any
+static void runFlow(const char* name, bool queued, bool xonXoff, bool rts, size_t count) {
+  static char lineBuffer[64];
+  static uint8_t ringBuffer[256];
+  static uint8_t queue[256];
+  ReceiveRing ring(ringBuffer);
+  FlowLink link;
+  link.ring = &ring;
+  for (size_t i = 0; i < count; ++i) {
+    link.input += "seq " + std::to_string(i) + "\n";
+  }
+  flowLink = &link;
+  flowReceived.assign(count, false);
+
+  FlowStream stream;
+  SerialCommands serialCommands(stream, flowCommands, sizeof(flowCommands) / sizeof(Command), lineBuffer, sizeof(lineBuffer));
+  serialCommands.setReceiveRing(&ring);
+  if (queued) serialCommands.enableQueue(queue, sizeof(queue));
+  if (xonXoff) serialCommands.enableFlowControl();
+  if (rts) serialCommands.enableFlowControl([](bool throttle) { flowLink->throttle(throttle); });
+
+  while (link.position < link.input.size() || ring.available() > 0 || serialCommands.hasPendingLines() || !serialCommands.isQueueEmpty()) {
+    serialCommands.readSerial();
+    serialCommands.poll();
+    link.tick(2);
+  }
+
+  size_t lost = std::count(flowReceived.begin(), flowReceived.end(), false);
+  printf("%-16s %14s %10s  lost %zu, link %.0f%%\n", name, "-", "-", lost, 100.0 * link.input.size() / link.ticks);
+  if (xonXoff || rts) {
+    check(name, lost == 0, "no command is lost");
+  }
+}
+
+static void printHeader() {
+  printf("%-16s %14s %10s %10s %10s %12s\n", "workload", "commands/s", "ns/byte", "p50 ns", "p99 ns", "out B/cmd");
+}
+
+static void printResult(const char* name, const Result& result) {
+  printf("%-16s %14.0f %10.2f %10.0f %10.0f %12.1f\n", name,
+         result.commandsPerSecond, result.nsPerByte, result.p50, result.p99, result.outputPerCommand);
+}
+
+// for input without errors, every line of the throughput and the latency run has to reach its command
+static void runValid(const char* name, SerialCommands& serialCommands, MockStream& stream, const std::vector<std::string>& lines, size_t count) {
+  uint32_t before = handled;
+  printResult(name, run(serialCommands, stream, lines, count));
+  check(name, handled - before == count + count / 10, "every command runs");
+}
+
+static uint32_t ulpDistance(float a, float b) {
+  int32_t ia, ib;
+  memcpy(&ia, &a, sizeof(ia));
+  memcpy(&ib, &b, sizeof(ib));
+  // order negative floats below positive ones
+  int64_t la = ia < 0 ? (int64_t) INT32_MIN - ia : ia;
+  int64_t lb = ib < 0 ? (int64_t) INT32_MIN - ib : ib;
+  return (uint32_t) (la > lb ? la - lb : lb - la);
+}
+
+// parse kernels against the C library on random input, reports speed and accuracy
+static void runParse(size_t count) {
+  std::mt19937 random(1);
+  std::vector<std::string> floats, ints;
+  floats.reserve(count);
+  ints.reserve(count);
+  std::uniform_int_distribution<int> exponents(-40, 38);
+  std::uniform_int_distribution<int> digitCounts(1, 12);
+  std::uniform_int_distribution<int> digits(0, 9);
+  for (size_t i = 0; i < count; ++i) {
+    std::string number = random() & 1 ? "-" : "";
+    int n = digitCounts(random);
+    int point = std::uniform_int_distribution<int>(0, n)(random);
+    for (int j = 0; j < n; ++j) {
+      if (j == point) number += '.';
+      number += (char) ('0' + digits(random));
+    }
+    if (random() % 3 == 0) number += "e" + std::to_string(exponents(random));
+    floats.push_back(number);
+    ints.push_back(std::to_string((int32_t) random()));
+  }
+
+  size_t failures = 0, over1ulp = 0;
+  uint32_t maxUlp = 0;
+  float sink = 0;
+  Clock::time_point begin = Clock::now();
+  for (const std::string& number : floats) {
+    float value;
+    if (parse::strtof(number.data(), number.size(), &value)) sink += value;
+  }
+  double kernelNs = elapsedNs(begin, Clock::now()) / count;
+
+  begin = Clock::now();
+  for (const std::string& number : floats) {
+    sink += (float) strtod(number.c_str(), nullptr);
+  }
+  double referenceNs = elapsedNs(begin, Clock::now()) / count;
+
+  for (const std::string& number : floats) {
+    float value;
+    float reference = strtof(number.c_str(), nullptr);
+    if (!parse::strtof(number.data(), number.size(), &value)) {
+      if (!isinf(reference)) failures++;
+      continue;
+    }
+    uint32_t ulp = ulpDistance(value, reference);
+    if (ulp > 1) over1ulp++;
+    if (ulp > maxUlp) maxUlp = ulp;
+  }
+
+  printf("\n%-16s %10s %12s %10s %12s %10s\n", "kernel", "ns/call", "libc ns/call", "max ulp", "> 1 ulp", "failed");
+  printf("%-16s %10.1f %12.1f %10u %12zu %10zu\n", "strtof", kernelNs, referenceNs, maxUlp, over1ulp, failures);
+  check("parse", failures == 0, "strtof parses every finite number");
+  check("parse", maxUlp <= 2, "strtof is within 2 ulp of the C library");
+
+  int64_t sum = 0;
+  begin = Clock::now();
+  for (const std::string& number : ints) {
+    int32_t value;
+    if (parse::strtoi(number.data(), number.size(), &value)) sum += value;
+  }
+  kernelNs = elapsedNs(begin, Clock::now()) / count;
+
+  begin = Clock::now();
+  for (const std::string& number : ints) {
+    sum += strtol(number.c_str(), nullptr, 10);
+  }
+  referenceNs = elapsedNs(begin, Clock::now()) / count;
+
+  failures = 0;
+  for (const std::string& number : ints) {
+    int32_t value;
+    if (!parse::strtoi(number.data(), number.size(), &value) || value != strtol(number.c_str(), nullptr, 10)) failures++;
+  }
+  printf("%-16s %10.1f %12.1f %10s %12s %10zu\n", "strtoi", kernelNs, referenceNs, "-", "-", failures);
+  check("parse", failures == 0, "strtoi matches strtol");
+
+  // prefixes, the limits of int32_t and uint32_t, and values just past them
+  struct IntCase {
+    const char* text;
+    bool valid;
+    int64_t value;
+  };
+  static const IntCase intCases[] {
+    { "2147483647", true, INT32_MAX }, { "-2147483648", true, INT32_MIN }, { "+2147483647", true, INT32_MAX },
+    { "2147483648", false, 0 }, { "-2147483649", false, 0 }, { "4294967296", false, 0 }, { "99999999999", false, 0 },
+    { "000000000002147483647", true, INT32_MAX }, { "-0", true, 0 }, { "12345678", true, 12345678 },
+    { "1234a678", false, 0 }, { "123456789", true, 123456789 }, { "12345678/", false, 0 }, { "1234:678", false, 0 },
+    { "0x7fffffff", true, INT32_MAX }, { "0X7FFFFFFF", true, INT32_MAX }, { "-0x80000000", true, INT32_MIN },
+    { "0x80000000", false, 0 }, { "0x1g", false, 0 }, { "0x", false, 0 }, { "0b101", true, 5 }, { "-0B1", true, -1 },
+    { "0b1111111111111111111111111111111", true, INT32_MAX }, { "0b10000000000000000000000000000000", false, 0 },
+    { "0b2", false, 0 }, { "", false, 0 }, { "-", false, 0 }, { "+", false, 0 }, { "1 ", false, 0 },
+  };
+  for (const IntCase& c : intCases) {
+    int32_t value = 0;
+    bool valid = parse::strtoi(c.text, strlen(c.text), &value);
+    if (valid != c.valid || (valid && value != c.value)) {
+      fprintf(stderr, "strtoi(\"%s\") = %d, %d\n", c.text, valid, (int) value);
+      check("parse", false, "strtoi edge case");
+    }
+  }
+  static const IntCase unsignedCases[] {
+    { "4294967295", true, UINT32_MAX }, { "4294967296", false, 0 }, { "0xffffffff", true, UINT32_MAX },
+    { "0x100000000", false, 0 }, { "0x00000000ffffffff", true, UINT32_MAX },
+    { "0b11111111111111111111111111111111", true, UINT32_MAX }, { "0b111111111111111111111111111111111", false, 0 },
+  };
+  for (const IntCase& c : unsignedCases) {
+    uint32_t value = 0;
+    bool valid = parse::strtou(c.text, strlen(c.text), &value);
+    if (valid != c.valid || (valid && value != c.value)) {
+      fprintf(stderr, "strtou(\"%s\") = %d, %u\n", c.text, valid, (unsigned) value);
+      check("parse", false, "strtou edge case");
+    }
+  }
+
+  // random hexadecimal values against strtoul
+  failures = 0;
+  for (size_t i = 0; i < count / 10; ++i) {
+    char text[16];
+    uint32_t expected = (uint32_t) random();
+    snprintf(text, sizeof(text), "0x%x", (unsigned) expected);
+    uint32_t value;
+    if (!parse::strtou(text, strlen(text), &value) || value != strtoul(text, nullptr, 16)) failures++;
+  }
+  check("parse", failures == 0, "strtou matches strtoul for 0x prefixes");
+
+  if (sink == 0.5f && sum == 1) printf("\n");  // keep the results alive
+}
+
+static bool selected(const char* name, const char* filter) {
+  return filter == nullptr || strstr(name, filter) != nullptr;
+}
+
+int main(int argc, char** argv) {
+  const char* filter = argc > 1 ? argv[1] : nullptr;
+  const size_t count = 200000;
+
+  static char buffer[256];
+  MockStream stream;
+
+  std::vector<std::string> flatLines;
+  for (int i = 10; i < 90; i += 7) {
+    flatLines.push_back("command" + std::to_string(i));
+  }
+
+  std::vector<std::string> deepLines {
+    "system device 3 channel 7 value 42",
+    "system device 1 channel 2 list",
+    "system device 2 reset",
+    "status",
+  };
+
+  std::vector<std::string> argLines {
+    "set 1 2 3 4 5 6 7 8 1.5 2.5 3.5 4.5 5.5 6.5 7.5 8.5",
+  };
+
+  std::vector<std::string> quotedLines {
+    "say \"hello world\" \"quoted argument with spaces\"",
+    "say plain \"one quoted\"",
+  };
+
+  std::vector<std::string> errorLines {
+    "missing command",
+    "pwm 3 300",
+    "pwm 3 x",
+    "pwm 3",
+    "pwm 3 100 7",
+    "pwm 3 100",
+  };
+
+  // the same three commands as one line each and as a single batch
+  std::vector<std::string> pwmLines {
+    "pwm 3 100",
+    "pwm 5 120",
+    "pwm 6 90",
+  };
+
+  std::vector<std::string> batchLines {
+    "pwm 3 100; pwm 5 120; pwm 6 90",
+  };
+
+  std::vector<std::string> bulkLines(1, "cal 3");
+  for (int i = 0; i < 32; ++i) {
+    bulkLines[0] += ' ' + std::to_string(i % 19 - 9) + ".5";
+  }
+
+  // binary frames for "pwm 3 100" and "pwm 13 7"
+  std::vector<std::string> frameLines {
+    encodeFrame({ 2, 3, 0, 0, 0, 100, 0, 0, 0 }),
+    encodeFrame({ 2, 13, 0, 0, 0, 7, 0, 0, 0 }),
+  };
+
+  printHeader();
+
+  if (selected("flat-linear", filter)) {
+    SerialCommands serialCommands(stream, flatCommands, sizeof(flatCommands) / sizeof(Command), buffer, sizeof(buffer));
+    runValid("flat-linear", serialCommands, stream, flatLines, count);
+  }
+
+  if (selected("flat-sorted", filter)) {
+    SerialCommands serialCommands(stream, flatCommands, sizeof(flatCommands) / sizeof(Command), buffer, sizeof(buffer));
+    serialCommands.sortCommands();
+    runValid("flat-sorted", serialCommands, stream, flatLines, count);
+  }
+
+  if (selected("flat-pgm", filter)) {
+    SerialCommands serialCommands(stream, PGM_COMMANDS(flatPgmCommands), buffer, sizeof(buffer), CMD_PGM_ARGS(flatPgmCommands));
+    runValid("flat-pgm", serialCommands, stream, flatLines, count);
+  }
+
+  if (selected("deep", filter)) {
+    SerialCommands serialCommands(stream, deepCommands, sizeof(deepCommands) / sizeof(Command), buffer, sizeof(buffer));
+    runValid("deep", serialCommands, stream, deepLines, count);
+  }
+
+  if (selected("deep-pgm", filter)) {
+    SerialCommands serialCommands(stream, PGM_COMMANDS(pgmDeepCommands), buffer, sizeof(buffer), CMD_PGM_ARGS(pgmDeepCommands));
+    runValid("deep-pgm", serialCommands, stream, deepLines, count);
+  }
+
+  if (selected("many-args", filter)) {
+    SerialCommands serialCommands(stream, argCommands, sizeof(argCommands) / sizeof(Command), buffer, sizeof(buffer));
+    runValid("many-args", serialCommands, stream, argLines, count);
+  }
+
+  if (selected("streamed", filter)) {
+    SerialCommands serialCommands(stream, argCommands, sizeof(argCommands) / sizeof(Command), buffer, sizeof(buffer));
+    runStreamed("streamed", serialCommands, stream, argLines, count / 10, 8);
+  }
+
+  if (selected("bulk", filter)) {
+    SerialCommands serialCommands(stream, bulkCommands, sizeof(bulkCommands) / sizeof(Command), buffer, sizeof(buffer));
+    runValid("bulk", serialCommands, stream, bulkLines, count / 10);
+  }
+
+  if (selected("quoted", filter)) {
+    SerialCommands serialCommands(stream, argCommands, sizeof(argCommands) / sizeof(Command), buffer, sizeof(buffer));
+    runValid("quoted", serialCommands, stream, quotedLines, count);
+  }
+
+  if (selected("errors", filter)) {
+    SerialCommands serialCommands(stream, argCommands, sizeof(argCommands) / sizeof(Command), buffer, sizeof(buffer));
+    printResult("errors", run(serialCommands, stream, errorLines, count));
+  }
+
+  if (selected("errors-buffered", filter)) {
+    static char txBuffer[256];
+    BufferedStream bufferedStream(stream, txBuffer, sizeof(txBuffer), FlushPolicy::Command);
+    SerialCommands serialCommands(bufferedStream, argCommands, sizeof(argCommands) / sizeof(Command), buffer, sizeof(buffer));
+    printResult("errors-buffered", run(serialCommands, stream, errorLines, count));
+  }
+
+  if (selected("errors-compact", filter)) {
+    SerialCommands serialCommands(stream, argCommands, sizeof(argCommands) / sizeof(Command), buffer, sizeof(buffer));
+    serialCommands.setErrorFormat(ErrorFormat::Compact);
+    printResult("errors-compact", run(serialCommands, stream, errorLines, count));
+  }
+
+  if (selected("line-per-command", filter)) {
+    SerialCommands serialCommands(stream, argCommands, sizeof(argCommands) / sizeof(Command), buffer, sizeof(buffer));
+    serialCommands.enableBatchStatus();
+    printResult("line-per-command", run(serialCommands, stream, pwmLines, count));
+  }
+
+  if (selected("batched", filter)) {
+    // three commands per line, p50 and p99 are per batch
+    SerialCommands serialCommands(stream, argCommands, sizeof(argCommands) / sizeof(Command), buffer, sizeof(buffer));
+    serialCommands.setSeparatorChars<';'>();
+    serialCommands.enableBatchStatus();
+    Result result = run(serialCommands, stream, batchLines, count / 3);
+    result.commandsPerSecond *= 3;
+    result.outputPerCommand /= 3;
+    printResult("batched", result);
+  }
+
+  if (selected("frames", filter)) {
+    SerialCommands serialCommands(stream, argCommands, sizeof(argCommands) / sizeof(Command), buffer, sizeof(buffer));
+    serialCommands.enableFrames();
+    printResult("frames", run(serialCommands, stream, frameLines, count));
+  }
+
+  if (selected("ring", filter)) {
+    SerialCommands serialCommands(stream, argCommands, sizeof(argCommands) / sizeof(Command), buffer, sizeof(buffer));
+    runRing(serialCommands, stream, pwmLines, count);
+  }
+
+  if (selected("pipeline", filter)) {
+    runPipeline(pwmLines, count);
+  }
+
+  if (selected("slow", filter)) {
+    SerialCommands serialCommands(stream, slowCommands, sizeof(slowCommands) / sizeof(Command), buffer, sizeof(buffer));
+    runSlow("slow", serialCommands, stream, count / 100);
+  }
+
+  if (selected("slow-queued", filter)) {
+    static uint8_t queue[256];
+    SerialCommands serialCommands(stream, slowCommands, sizeof(slowCommands) / sizeof(Command), buffer, sizeof(buffer));
+    serialCommands.enableQueue(queue, sizeof(queue));
+    runSlow("slow-queued", serialCommands, stream, count / 100);
+  }
+
+  if (selected("flow-none", filter)) {
+    runFlow("flow-none", true, false, false, count / 10);
+  }
+
+  if (selected("flow-xonxoff", filter)) {
+    runFlow("flow-xonxoff", true, true, false, count / 10);
+  }
+
+  if (selected("flow-rts", filter)) {
+    runFlow("flow-rts", false, false, true, count / 10);
+  }
+
+  if (selected("multi-port", filter)) {
+    // three ports sharing the flat table, polled by SerialCommandsGroup
+    const size_t portsCount = 3;
+    static char buffers[portsCount][CMD_BUFFER_SIZE];
+    MockStream streams[portsCount];
+    SerialCommands ports[] {
+      SerialCommands(streams[0], flatCommands, sizeof(flatCommands) / sizeof(Command), buffers[0], CMD_BUFFER_SIZE),
+      SerialCommands(streams[1], flatCommands, sizeof(flatCommands) / sizeof(Command), buffers[1], CMD_BUFFER_SIZE),
+      SerialCommands(streams[2], flatCommands, sizeof(flatCommands) / sizeof(Command), buffers[2], CMD_BUFFER_SIZE),
+    };
+    SerialCommandsGroup group(ports, portsCount);
+
+    std::string input = joinLines(flatLines, count / portsCount);
+    for (size_t i = 0; i < portsCount; ++i) {
+      streams[i].setInput(input);
+    }
+    uint32_t before = handled;
+    Clock::time_point begin = Clock::now();
+    bool pending = true;
+    while (pending) {
+      group.readSerial();
+      pending = false;
+      for (size_t i = 0; i < portsCount; ++i) {
+        pending = pending || streams[i].available() > 0;
+      }
+    }
+    double ns = elapsedNs(begin, Clock::now());
+    printf("%-16s %14.0f %10.2f\n", "multi-port", (handled - before) / (ns / 1e9), ns / (input.size() * portsCount));
+  }
+
+  if (selected("parse", filter)) {
+    runParse(2000000);
+  }
+
+  return failedChecks == 0 ? 0 : 1;
+}
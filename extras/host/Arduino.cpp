@@ -0,0 +1,27 @@
+/*---------------------------------------------------------------------
+Author         : naszly
+License        : BSD
+Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
+-----------------------------------------------------------------------*/
+
+#include <chrono>
+#include <thread>
+#include "Arduino.h"
+
+static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+unsigned long millis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+unsigned long micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void delay(unsigned long ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void yield() {
+  std::this_thread::yield();
+}
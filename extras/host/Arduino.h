@@ -0,0 +1,154 @@
+/*---------------------------------------------------------------------
+Author         : naszly
+License        : BSD
+Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
+-----------------------------------------------------------------------*/
+
+// Minimal Arduino API for building the library on a desktop host.
+// Program memory is ordinary memory, so every pgm_read_* is a plain read of the width
+// it has on the boards, a pointer read with pgm_read_word is truncated here as well.
+
+#ifndef STATIC_SERIAL_COMMANDS_HOST_ARDUINO_H
+#define STATIC_SERIAL_COMMANDS_HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+#define PROGMEM
+#define PGM_P const char*
+#define PGM_VOID_P const void*
+
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+#define pgm_read_float(addr) (*(const float*)(addr))
+#define pgm_read_ptr(addr) (*(void* const*)(addr))
+
+#define memcpy_P memcpy
+#define memcmp_P memcmp
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strlen_P strlen
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper*>(string_literal))
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+
+class Print {
+  public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t) = 0;
+
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+      size_t n = 0;
+      while (size--) {
+        if (write(*buffer++)) n++;
+        else break;
+      }
+      return n;
+    }
+
+    size_t write(const char* str) {
+      return str == nullptr ? 0 : write((const uint8_t*)str, strlen(str));
+    }
+
+    size_t write(const char* buffer, size_t size) {
+      return write((const uint8_t*)buffer, size);
+    }
+
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t print(const __FlashStringHelper* str) { return write((const char*)str); }
+    size_t print(const char str[]) { return write(str); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(long n, int base = DEC) {
+      if (base == DEC && n < 0) {
+        return print('-') + printNumber(0ul - (unsigned long)n, base);
+      }
+      return printNumber((unsigned long)n, base);
+    }
+    size_t print(unsigned long n, int base = DEC) { return printNumber(n, base); }
+    size_t print(double n, int digits = 2) {
+      char buf[48];
+      int len = snprintf(buf, sizeof(buf), "%.*f", digits, n);
+      return write(buf, len);
+    }
+
+    size_t println() { return write("\r\n"); }
+
+    template<typename T>
+    size_t println(T value) {
+      size_t n = print(value);
+      return n + println();
+    }
+
+    template<typename T>
+    size_t println(T value, int format) {
+      size_t n = print(value, format);
+      return n + println();
+    }
+
+  private:
+    size_t printNumber(unsigned long n, int base) {
+      char buf[8 * sizeof(long) + 1];
+      char* str = &buf[sizeof(buf) - 1];
+      *str = '\0';
+      if (base < 2) base = 10;
+      do {
+        char c = n % base;
+        n /= base;
+        *--str = c < 10 ? c + '0' : c + 'A' - 10;
+      } while (n);
+      return write(str);
+    }
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    size_t readBytes(char* buffer, size_t length) {
+      size_t count = 0;
+      while (count < length) {
+        int c = read();
+        if (c < 0) break;
+        *buffer++ = (char)c;
+        count++;
+      }
+      return count;
+    }
+
+    size_t readBytes(uint8_t* buffer, size_t length) {
+      return readBytes((char*)buffer, length);
+    }
+};
+
+#endif // STATIC_SERIAL_COMMANDS_HOST_ARDUINO_H
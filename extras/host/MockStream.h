@@ -0,0 +1,86 @@
+/*---------------------------------------------------------------------
+Author         : naszly
+License        : BSD
+Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
+-----------------------------------------------------------------------*/
+
+#ifndef STATIC_SERIAL_COMMANDS_HOST_MOCK_STREAM_H
+#define STATIC_SERIAL_COMMANDS_HOST_MOCK_STREAM_H
+
+#include <string>
+#include "Arduino.h"
+
+// In-memory Stream: reads from an input string, collects or counts output.
+// chunkSize limits available() to emulate a UART that delivers bytes in bursts.
+class MockStream : public Stream {
+  public:
+    explicit MockStream(size_t chunkSize = SIZE_MAX) : chunkSize(chunkSize) {}
+
+    void setInput(const std::string& input) {
+      this->input = input;
+      position = 0;
+    }
+
+    void setInput(const char* data, size_t length) {
+      input.assign(data, length);
+      position = 0;
+    }
+
+    void setCaptureOutput(bool capture) {
+      captureOutput = capture;
+    }
+
+    const std::string& getOutput() const {
+      return output;
+    }
+
+    size_t getOutputSize() const {
+      return outputSize;
+    }
+
+    void clearOutput() {
+      output.clear();
+      outputSize = 0;
+    }
+
+    int available() override {
+      size_t remaining = input.size() - position;
+      return (int)(remaining < chunkSize ? remaining : chunkSize);
+    }
+
+    int read() override {
+      return position < input.size() ? (uint8_t)input[position++] : -1;
+    }
+
+    int peek() override {
+      return position < input.size() ? (uint8_t)input[position] : -1;
+    }
+
+    size_t write(uint8_t c) override {
+      if (captureOutput) output += (char)c;
+      outputSize++;
+      return 1;
+    }
+
+    size_t write(const uint8_t* buffer, size_t size) override {
+      if (captureOutput) output.append((const char*)buffer, size);
+      outputSize += size;
+      return size;
+    }
+
+    int availableForWrite() override {
+      return INT16_MAX;
+    }
+
+    using Print::write;
+
+  private:
+    std::string input;
+    size_t position = 0;
+    size_t chunkSize;
+    std::string output;
+    size_t outputSize = 0;
+    bool captureOutput = false;
+};
+
+#endif // STATIC_SERIAL_COMMANDS_HOST_MOCK_STREAM_H
@@ -8,7 +8,11 @@ Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
 #define STATIC_SERIAL_COMMANDS_ARG_H
 #include <Arduino.h>
 
-#define MAX_ARGS 16
+// 1: arguments are converted and range checked when the command function reads them
+// 0: every argument is converted and range checked before the command function runs
+#ifndef CMD_LAZY_ARGS
+#define CMD_LAZY_ARGS 0
+#endif
 
 #define GET_1_CHAR(str, i) (sizeof(str) > (i) ? str[(i)] : 0)
 
@@ -26,13 +30,13 @@ Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
   impl::ArgConstraint(type)
 
 #define ARG_2(type, name) \
-  impl::ArgConstraint(type, impl::ArgConstraint::getNamePgm<GET_STR(name)>)
+  impl::ArgConstraint(type, impl::Name<sizeof(name), GET_STR(name)>::value)
 
 #define ARG_3(type, min, max) \
-  impl::ArgConstraint(type, impl::ArgConstraint::getRange<min,max>)
+  impl::RangedArgConstraint(type, min, max)
 
 #define ARG_4(type, min, max, name) \
-  impl::ArgConstraint(type, impl::ArgConstraint::getRange<min,max>, impl::ArgConstraint::getNamePgm<GET_STR(name)>)
+  impl::RangedArgConstraint(type, min, max, impl::Name<sizeof(name), GET_STR(name)>::value)
 
 #define ARG_X(a0, a1, a2, a3, a4, FUNC, ...)  FUNC
 
@@ -44,6 +48,16 @@ Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
         ARG_1(__VA_ARGS__) \
        )
 
+// exactly count arguments, each checked against the same constraint:
+//   ARG_ARRAY(8, ArgType::Int, 0, 255, "duty")
+#define ARG_ARRAY(count, ...) \
+  ARG(__VA_ARGS__).repeat(count, count)
+
+// up to maxCount arguments until the end of the command, the last argument of a command without subcommands:
+//   ARG_VARIADIC(64, ArgType::Float, -10, 10, "coefficient")
+#define ARG_VARIADIC(maxCount, ...) \
+  ARG(__VA_ARGS__).repeat(0, maxCount)
+
 enum class ArgType : uint8_t {
   Null,
   Int,
@@ -51,10 +65,17 @@ enum class ArgType : uint8_t {
   String
 };
 
+namespace impl {
+struct ArgConstraint;
+}
+
 union ArgData {
   int32_t num;
   float num_f;
-  const char* string;
+  struct {
+    const char* chars;
+    uint16_t length;
+  } string;
 };
 
 class Arg {
@@ -65,31 +86,109 @@ class Arg {
     explicit Arg(float value)
       : value{ .num_f = value }, type(ArgType::Float) {}
     explicit Arg(const char* value)
-      : value{ .string = value }, type(ArgType::String) {}
+      : Arg(value, strlen(value)) {}
+    Arg(const char* value, uint16_t length)
+      : value{ .string = { value, length } }, type(ArgType::String) {}
+
+#if CMD_LAZY_ARGS
+    // unconverted token, constraint points to program memory
+    Arg(const char* value, uint16_t length, const impl::ArgConstraint* constraint)
+      : value{ .string = { value, length } }, type(ArgType::Null),
+        state(State::Pending), constraint(constraint) {}
+#endif
 
     int32_t getInt() {
+      convert();
       return value.num;
     }
 
     float getFloat() {
+      convert();
       return value.num_f;
     }
 
+    // strings are terminated copies of the slices of the received line,
+    // the line itself is not changed
     const char* getString() {
-      return value.string;
+      convert();
+      return value.string.chars;
+    }
+
+    const char* getChars() {
+      convert();
+      return value.string.chars;
+    }
+
+    uint16_t getLength() {
+      convert();
+      return value.string.length;
     }
 
     ArgType getType() {
+      convert();
       return type;
     }
 
+    // With CMD_LAZY_ARGS the argument is converted and checked on the first read, false if it
+    // can't be parsed or it is out of range, the error is printed after the command function returns.
+    // Until then getInt and getFloat return 0 for a token that can't be parsed and the nearest bound
+    // for a value out of range, a command function should return without acting if this is false.
+    // Without CMD_LAZY_ARGS a command only runs with valid arguments and this is always true.
+    bool isValid() {
+      convert();
+#if CMD_LAZY_ARGS
+      return state == State::Valid;
+#else
+      return true;
+#endif
+    }
+
   private:
     ArgData value;
     ArgType type;
+
+    friend class SerialCommands;
+
+#if CMD_LAZY_ARGS
+    enum class State : uint8_t {
+      Valid,
+      Pending,
+      ParseError,
+      RangeError
+    };
+
+    State state = State::Valid;
+    const impl::ArgConstraint* constraint = nullptr;
+
+    void convert() {
+      if (state == State::Pending) convertToken();
+    }
+
+    void convertToken();
+
+    // strings and unconverted tokens point into the line buffer
+    bool isSlice() const {
+      return type == ArgType::String || state == State::Pending;
+    }
+#else
+    void convert() {}
+
+    bool isSlice() const {
+      return type == ArgType::String;
+    }
+#endif
 };
 
+// arguments of the running command, indices from getCount() on are not valid
 class Args {
   public:
+    Args(Arg* args, uint8_t count)
+      : args(args), count(count) {}
+
+    uint8_t getCount() const {
+      return count;
+    }
+
     Arg& operator[](uint8_t idx) {
       return args[idx];
     }
@@ -99,65 +198,142 @@ class Args {
     }
 
   private:
-    Arg args[MAX_ARGS];
+    Arg* args;
+    uint8_t count;
 };
 
 namespace impl {
 
-struct Range {
-  constexpr Range(int32_t minimum, int32_t maximum) : minimum(minimum), maximum(maximum) {}
-  int32_t minimum;
-  int32_t maximum;
+template<size_t... indices>
+struct Indices {};
+
+template<size_t count, size_t... indices>
+struct MakeIndices : MakeIndices<count - 1, count - 1, indices...> {};
+
+template<size_t... indices>
+struct MakeIndices<0, indices...> {
+  typedef Indices<indices...> type;
 };
 
-struct ArgConstraint {
-  ArgConstraint()
-    : type(ArgType::Null), getRangeFn(nullptr), getNamePgmFn(nullptr) {}
+template<size_t index, char first, char... rest>
+struct CharAt : CharAt<index - 1, rest...> {};
+
+template<char first, char... rest>
+struct CharAt<0, first, rest...> {
+  static constexpr char value = first;
+};
+
+template<typename Indices, char... chars>
+struct NameChars;
+
+// the characters of a name up to its terminator, without the padding of GET_STR
+template<size_t... indices, char... chars>
+struct NameChars<Indices<indices...>, chars...> {
+  static constexpr char value[sizeof...(indices)] PROGMEM = { CharAt<indices, chars...>::value... };
+};
+
+template<size_t... indices, char... chars>
+constexpr char NameChars<Indices<indices...>, chars...>::value[sizeof...(indices)] PROGMEM;
+
+// argument names are shared by every argument with the same name,
+// each name is stored once and takes its length and the terminator
+template<size_t length, char... chars>
+struct Name : NameChars<typename MakeIndices<(length <= sizeof...(chars) ? length : 1)>::type, chars...> {
+  static_assert(length <= sizeof...(chars), "argument names are limited to 16 characters");
+};
+
+// the name of an argument without one, it is empty so that the presence of a name
+// can be tested in constant expressions without comparing addresses
+typedef Name<1, '\0'> NoName;
+
+union Bound {
+  constexpr Bound(int32_t value) : num(value) {}
+  constexpr Bound(float value) : num_f(value) {}
+  int32_t num;
+  float num_f;
+};
+
+// the bounds of an argument with a range, a command stores them after its constraints
+struct ArgRange {
+  Bound minimum;
+  Bound maximum;
+};
 
-  constexpr ArgConstraint(const ArgType type)
-    : type(type), getRangeFn(nullptr), getNamePgmFn(nullptr) {}
+// Stored in program memory as part of a command, every member function
+// reads only the fields it needs. Only arguments with a range are range checked,
+// the others accept the whole range of their type and store no bounds.
+struct ArgConstraint {
+  constexpr ArgConstraint(const ArgType type, PGM_P name = NoName::value)
+    : type(type), minCount(1), maxCount(1), range(0), name(name) {}
 
-  constexpr ArgConstraint(const ArgType type, Range (*getRangeFn)())
-    : type(type), getRangeFn(getRangeFn), getNamePgmFn(nullptr) {}
+  constexpr ArgConstraint(const ArgConstraint& argc, uint8_t minCount, uint8_t maxCount, uint16_t range)
+    : type(argc.type), minCount(minCount), maxCount(maxCount), range(range), name(argc.name) {}
 
-  constexpr ArgConstraint(const ArgType type, PGM_P (*getNamePgmFn)())
-    : type(type), getRangeFn(nullptr), getNamePgmFn(getNamePgmFn) {}
+  // the constraint taken by minCount to maxCount consecutive arguments, see ARG_ARRAY
+  constexpr ArgConstraint repeat(uint8_t minCount, uint8_t maxCount) const {
+    return ArgConstraint(*this, minCount, maxCount, range);
+  }
 
-  constexpr ArgConstraint(const ArgType type, Range (*getRangeFn)(), PGM_P (*getNamePgmFn)())
-    : type(type), getRangeFn(getRangeFn), getNamePgmFn(getNamePgmFn) {}
+  // the constraint as stored in a command, range is the offset of its bounds
+  constexpr ArgConstraint withRange(uint16_t range) const {
+    return ArgConstraint(*this, minCount, maxCount, range);
+  }
 
   const ArgType type;
-  Range (*getRangeFn)();
-  PGM_P (*getNamePgmFn)();
+  const uint8_t minCount;
+  const uint8_t maxCount;
+  const uint16_t range;  // bytes from the constraint to its ArgRange, 0 without a range
+  PGM_P const name;
+
+  ArgType getType() const {
+    return (ArgType) pgm_read_byte(&type);
+  }
+
+  uint8_t getMinCount() const {
+    return pgm_read_byte(&minCount);
+  }
+
+  uint8_t getMaxCount() const {
+    return pgm_read_byte(&maxCount);
+  }
 
   PGM_P getNamePgm() const {
-    if (getNamePgmFn) {
-      return (*getNamePgmFn)();
-    } else {
-      return getTypeNamePgm(type);
-    }
+    PGM_P namePgm = (PGM_P) pgm_read_ptr(&name);
+    return pgm_read_byte(namePgm) != '\0' ? namePgm : getTypeNamePgm(getType());
   }
 
-  bool isInRange(Arg arg) {
-    if (getRangeFn) {
-      Range range = (*getRangeFn)();
-      switch (arg.getType()) {
-        case ArgType::Int:
-          return arg.getInt() >= range.minimum && arg.getInt() <= range.maximum;
-        case ArgType::Float:
-          return arg.getFloat() >= range.minimum && arg.getFloat() <= range.maximum;
-        default:
-          return true;
-      }
-    }
-    return true;
+  const ArgRange* getRange() const {
+    uint16_t offset = pgm_read_word(&range);
+    return offset != 0 ? (const ArgRange*) ((const char*) this + offset) : nullptr;
   }
 
-  Range getRange() {
-    if (getRangeFn) {
-      return (*getRangeFn)();
+  bool isInRange(Arg& arg) const {
+    const ArgRange* bounds = getRange();
+    if (bounds == nullptr)
+      return true;
+    switch (arg.getType()) {
+      case ArgType::Int:
+        return arg.getInt() >= (int32_t) pgm_read_dword(&bounds->minimum.num) && arg.getInt() <= (int32_t) pgm_read_dword(&bounds->maximum.num);
+      case ArgType::Float:
+        return arg.getFloat() >= pgm_read_float(&bounds->minimum.num_f) && arg.getFloat() <= pgm_read_float(&bounds->maximum.num_f);
+      default:
+        return true;
     }
-    return Range(INT32_MIN, INT32_MAX);
+  }
+
+  // the bounds as arguments of the constraint's type
+  Arg getMinimum() const {
+    const ArgRange* bounds = getRange();
+    if (getType() == ArgType::Float)
+      return Arg(bounds ? pgm_read_float(&bounds->minimum.num_f) : -__builtin_inff());
+    return Arg(bounds ? (int32_t) pgm_read_dword(&bounds->minimum.num) : (int32_t) INT32_MIN);
+  }
+
+  Arg getMaximum() const {
+    const ArgRange* bounds = getRange();
+    if (getType() == ArgType::Float)
+      return Arg(bounds ? pgm_read_float(&bounds->maximum.num_f) : __builtin_inff());
+    return Arg(bounds ? (int32_t) pgm_read_dword(&bounds->maximum.num) : (int32_t) INT32_MAX);
   }
 
   static PGM_P getTypeNamePgm(ArgType type) {
@@ -166,20 +342,31 @@ struct ArgConstraint {
     static const char _float[] PROGMEM = "float";
     static const char _string[] PROGMEM = "string";
     static const char* const types[] PROGMEM{ _null, _int, _float, _string };
-    return (PGM_P) pgm_read_word(&(types[(int) type]));
+    return (PGM_P) pgm_read_ptr(&(types[(int) type]));
   }
 
-  template<char... chars>
-  static PGM_P getNamePgm() {
-    static const char _name[] PROGMEM = { chars... };
-    return _name;
-  }
+};
 
-  template<int32_t min, int32_t max>
-  static Range getRange() {
-    return Range(min, max);
+// An argument with a range, built by ARG. A command stores its bounds after
+// the constraints and only for the arguments that have a range.
+struct RangedArgConstraint : ArgConstraint {
+  template<typename Min, typename Max>
+  constexpr RangedArgConstraint(const ArgType type, Min minimum, Max maximum, PGM_P name = NoName::value)
+    : ArgConstraint(type, name), bounds{ bound(type, minimum), bound(type, maximum) } {}
+
+  constexpr RangedArgConstraint(const RangedArgConstraint& argc, uint8_t minCount, uint8_t maxCount)
+    : ArgConstraint(argc, minCount, maxCount, 0), bounds(argc.bounds) {}
+
+  constexpr RangedArgConstraint repeat(uint8_t minCount, uint8_t maxCount) const {
+    return RangedArgConstraint(*this, minCount, maxCount);
   }
 
+  const ArgRange bounds;
+
+  template<typename T>
+  static constexpr Bound bound(ArgType type, T value) {
+    return type == ArgType::Float ? Bound((float) value) : Bound((int32_t) value);
+  }
 };
 
 }
@@ -0,0 +1,75 @@
+/*---------------------------------------------------------------------
+Author         : naszly
+License        : BSD
+Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
+-----------------------------------------------------------------------*/
+
+#include "BufferedStream.h"
+
+size_t BufferedStream::write(const uint8_t* data, size_t size) {
+  size_t written = 0;
+  while (written < size) {
+    if (count == bufferSize) {
+      // full: make room by sending what the stream takes right now,
+      // output that isn't allowed to be sent yet only as far as it fits
+      uint16_t room = getStreamRoom();
+      if (committed < room) committed = room < count ? room : count;
+      poll();
+      if (count == bufferSize) break;
+    }
+
+    uint16_t tail = bufferSize - head > count ? head + count : count - (bufferSize - head);
+    uint16_t n = bufferSize - count;
+    if (n > bufferSize - tail) n = bufferSize - tail;
+    if (n > size - written) n = size - written;
+    memcpy(buffer + tail, data + written, n);
+    count += n;
+    written += n;
+
+    if (policy == FlushPolicy::Line) {
+      for (uint16_t i = n; i > 0; --i) {
+        if (buffer[tail + i - 1] == '\n') {
+          committed = count - (n - i);
+          break;
+        }
+      }
+    }
+  }
+
+  if (policy == FlushPolicy::Level && count >= flushLevel) {
+    committed = count;
+  }
+
+  dropped += size - written;
+  poll();
+  return written;
+}
+
+uint16_t BufferedStream::getStreamRoom() {
+  int room = stream.availableForWrite();
+  if (room > 0) {
+    roomReported = true;
+    return room > bufferSize ? bufferSize : room;
+  }
+  // Stream::availableForWrite() returns 0 if the stream doesn't implement it,
+  // such a stream is written blocking
+  return roomReported ? 0 : bufferSize;
+}
+
+void BufferedStream::poll() {
+  while (committed > 0) {
+    uint16_t room = getStreamRoom();
+    if (room == 0) break;
+
+    uint16_t n = committed;
+    if (n > bufferSize - head) n = bufferSize - head;
+    if (n > room) n = room;
+    n = stream.write((const uint8_t*) buffer + head, n);
+    if (n == 0) break;
+
+    head += n;
+    if (head == bufferSize) head = 0;
+    count -= n;
+    committed -= n;
+  }
+}
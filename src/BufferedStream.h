@@ -0,0 +1,103 @@
+/*---------------------------------------------------------------------
+Author         : naszly
+License        : BSD
+Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
+-----------------------------------------------------------------------*/
+
+#ifndef STATIC_SERIAL_COMMANDS_BUFFERED_STREAM_H
+#define STATIC_SERIAL_COMMANDS_BUFFERED_STREAM_H
+
+#include <Arduino.h>
+
+// when buffered output is allowed to be sent
+enum class FlushPolicy : uint8_t {
+  Manual,   // only after flush()
+  Line,     // after every new line
+  Command,  // after every command
+  Level     // when the buffer is filled up to the flush level
+};
+
+// Stream wrapper that collects output in a ring buffer and sends it
+// only as fast as the wrapped stream accepts it, so writing never blocks.
+// A stream that never reports room in availableForWrite() is written blocking.
+// Reading is passed through to the wrapped stream.
+class BufferedStream : public Stream {
+  public:
+    BufferedStream(Stream& stream, char* buffer, uint16_t bufferSize,
+                   FlushPolicy policy = FlushPolicy::Line, uint16_t flushLevel = 0)
+      : stream(stream), buffer(buffer), bufferSize(bufferSize) {
+      setFlushPolicy(policy, flushLevel);
+    }
+
+    int available() override {
+      return stream.available();
+    }
+
+    int read() override {
+      return stream.read();
+    }
+
+    int peek() override {
+      return stream.peek();
+    }
+
+    size_t write(uint8_t c) override {
+      return write(&c, 1);
+    }
+
+    size_t write(const uint8_t* data, size_t size) override;
+
+    using Print::write;
+
+    int availableForWrite() override {
+      return bufferSize - count;
+    }
+
+    // allows everything written so far to be sent, does not wait for it
+    void flush() override {
+      committed = count;
+      poll();
+    }
+
+    // sends as much of the allowed output as the stream accepts without blocking
+    void poll();
+
+    void endCommand() {
+      if (policy == FlushPolicy::Command) flush();
+    }
+
+    // flushLevel is used by FlushPolicy::Level, 0 means half of the buffer
+    void setFlushPolicy(FlushPolicy policy, uint16_t flushLevel = 0) {
+      this->policy = policy;
+      this->flushLevel = flushLevel != 0 ? flushLevel : bufferSize / 2;
+    }
+
+    uint16_t getPending() {
+      return count;
+    }
+
+    // bytes lost because the buffer was full
+    uint32_t getDropped() {
+      return dropped;
+    }
+
+    Stream& getStream() {
+      return stream;
+    }
+
+  private:
+    uint16_t getStreamRoom();
+
+    Stream& stream;
+    char* buffer;
+    const uint16_t bufferSize;
+    uint16_t head = 0;
+    uint16_t count = 0;
+    uint16_t committed = 0;
+    uint16_t flushLevel;
+    FlushPolicy policy;
+    uint32_t dropped = 0;
+    bool roomReported = false;  // availableForWrite() of the stream returned more than 0
+};
+
+#endif // STATIC_SERIAL_COMMANDS_BUFFERED_STREAM_H
@@ -8,28 +8,27 @@ Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
 #define STATIC_SERIAL_COMMANDS_COMMAND_H
 
 #include <Arduino.h>
-#include "CommandBuilder.h"
 #include "Arg.h"
 
 class SerialCommands;
 
 namespace impl {
   
-template<uint8_t commandLength = 0, uint16_t descriptionLength = 0, uint8_t argCount = 0>
+template<uint8_t commandLength = 0, uint16_t descriptionLength = 0, uint8_t argCount = 0, uint8_t rangeCount = 0>
 struct Command {
-  PGM_P (*getCommandPgmFn)(PGM_VOID_P);
   PGM_P (*getDescriptionPgmFn)(PGM_VOID_P);
   const impl::ArgConstraint* (*getArgsPgmFn)(PGM_VOID_P, uint8_t*);
   void (*function)(SerialCommands&, Args&);
   const void* subcommands;
   const uint16_t subcommandsCount;
+  // command name comes before every length dependent member,
+  // so its offset is the same for all instantiations
   const char command[commandLength];
   const char description[descriptionLength];
   const ArgConstraint args[argCount];
-
-  static PGM_P _getCommandPgm(PGM_VOID_P cmdPtr) {
-    return ((const Command<commandLength, descriptionLength, argCount>*)cmdPtr)->command;
-  }
+  // bounds of the arguments with a range, they come last, so commands that differ
+  // only in rangeCount share the accessor functions of the layout without ranges
+  const ArgRange ranges[rangeCount];
 
   static PGM_P _getDescriptionPgm(PGM_VOID_P cmdPtr) {
     return ((const Command<commandLength, descriptionLength, argCount>*)cmdPtr)->description;
@@ -44,54 +43,195 @@ struct Command {
 
 class Command {
   public:
+    constexpr Command()
+      : _command(nullptr) {}
+
     constexpr Command(const void* command)
-      : _command((const impl::Command<>*)command), parent(nullptr) {}
+      : _command(command) {}
 
-    constexpr Command(const void* command, const void* parent)
-      : _command((const impl::Command<>*)command), parent((const impl::Command<>*)parent) {}
+    // reads an element of a command table stored in program memory
+    static Command readPgm(const Command* command) {
+      return Command(pgm_read_ptr(&(command->_command)));
+    }
 
     PGM_P getCommandPgm() const {
-      PGM_P (*_getCommandPgmFn)(PGM_VOID_P) = pgm_read_word(&(_command->getCommandPgmFn));
-      return (*_getCommandPgmFn)(_command);
+      return (PGM_P)_command + offsetof(impl::Command<>, command);
     }
 
     PGM_P getDescriptionPgm() const {
-      PGM_P (*_getDescriptionPgmFn)(PGM_VOID_P) = pgm_read_word(&(_command->getDescriptionPgmFn));
+      PGM_P (*_getDescriptionPgmFn)(PGM_VOID_P) = (PGM_P (*)(PGM_VOID_P)) pgm_read_ptr(&(get()->getDescriptionPgmFn));
       return (*_getDescriptionPgmFn)(_command);
     }
 
     const impl::ArgConstraint* getArgsPgm(uint8_t* count) const {
-      impl::ArgConstraint* (*_getArgsPgmFn)(PGM_VOID_P, uint8_t*) = pgm_read_word(&(_command->getArgsPgmFn));
+      const impl::ArgConstraint* (*_getArgsPgmFn)(PGM_VOID_P, uint8_t*) =
+        (const impl::ArgConstraint* (*)(PGM_VOID_P, uint8_t*)) pgm_read_ptr(&(get()->getArgsPgmFn));
       return (*_getArgsPgmFn)(_command, count);
     }
 
     void runCommand(SerialCommands &sender, Args &args) const {
-      void (*function)(SerialCommands&, Args&) = pgm_read_word(&(_command->function));
+      void (*function)(SerialCommands&, Args&) = (void (*)(SerialCommands&, Args&)) pgm_read_ptr(&(get()->function));
       if (function) {
         (*function)(sender, args);
       }
     }
 
     void getSubCommands(const Command** commands, uint16_t* count) const {
-      *commands = pgm_read_word(&(_command->subcommands));
-      *count = pgm_read_word(&(_command->subcommandsCount));
+      *commands = (const Command*) pgm_read_ptr(&(get()->subcommands));
+      *count = pgm_read_word(&(get()->subcommandsCount));
     }
 
-    const Command getParent() const {
-      return Command(parent);
+    const impl::Command<>* get() const {
+      return (const impl::Command<>*)_command;
     }
 
-    bool hasParent() const {
-      return parent != nullptr;
+    explicit operator bool() const {
+      return _command != nullptr;
     }
 
-    const impl::Command<>* get() {
-      return _command;
+    bool operator==(const Command& other) const {
+      return _command == other._command;
     }
 
   private:
-    const impl::Command<>* _command;
-    const impl::Command<>* parent;
+    // a const void* keeps the constructor usable in constant expressions
+    const void* _command;
+};
+
+// command table in program memory with the trie of its names, see PGM_COMMAND_TABLE
+struct PgmCommands {
+  const Command* commands;
+  uint16_t count;
+};
+
+// Code bytes of the pair of accessor functions of a layout and stack bytes that printing
+// a command with its parents takes per level of the tree, printCommandPath and findParent.
+// They are taken from the object files and -fstack-usage of each kind of target
+// and can be defined to the values of another compiler.
+#ifndef CMD_THUNK_BYTES
+#if defined(__AVR__)
+#define CMD_THUNK_BYTES 18
+#elif UINTPTR_MAX > 0xFFFFFFFF
+#define CMD_THUNK_BYTES 32
+#else
+#define CMD_THUNK_BYTES 12
+#endif
+#endif
+
+#ifndef CMD_LEVEL_STACK_BYTES
+#if defined(__AVR__)
+#define CMD_LEVEL_STACK_BYTES 40
+#elif UINTPTR_MAX > 0xFFFFFFFF
+#define CMD_LEVEL_STACK_BYTES 176
+#else
+#define CMD_LEVEL_STACK_BYTES 72
+#endif
+#endif
+
+// Memory used by a command tree in program memory, known at compile time, see PGM_COMMAND_TABLE.
+// A table that is the subcommands of several commands is counted once for each of them.
+struct CommandFootprint {
+  uint16_t commands;
+  uint32_t flashBytes;  // command data (names, descriptions, argument constraints), table entries and argument names
+  uint16_t layouts;     // distinct command layouts, each one has its own pair of accessor functions
+  uint16_t maxArgs;     // arguments of the path with the most, arrays and variadic arguments at their largest
+  uint8_t depth;        // tables on the longest path, it bounds the recursion of printing a command with its parents
+  bool stringArgs;      // a String argument somewhere in the tree, it needs the buffer of string copies
+
+  // the argument storage that SerialCommands allocates for a line without separators
+  constexpr uint32_t getArgsBytes() const {
+    return (uint32_t) maxArgs * sizeof(Arg);
+  }
+
+  // code of the accessor functions, flashBytes doesn't include it
+  constexpr uint32_t getThunkBytes() const {
+    return (uint32_t) layouts * CMD_THUNK_BYTES;
+  }
+
+  // worst case stack of the recursion over the levels of the tree
+  constexpr uint32_t getStackBytes() const {
+    return (uint32_t) depth * CMD_LEVEL_STACK_BYTES;
+  }
 };
 
+namespace impl {
+
+// A node of the trie of the command names of a table defined with PGM_COMMAND_TABLE, stored after
+// its entries. The nodes are in preorder, the first child of a node follows it and the other
+// children are linked by next. A node stands for a prefix that ends a name or is shared by
+// names that continue with different characters, the root for the empty prefix.
+struct TrieNode {
+  char c;          // first character after the prefix of the parent
+  uint8_t length;  // characters of the prefix, with TrieLeaf if only one name starts with it
+  uint16_t next;   // next child of the parent, 0 after the last one
+  uint16_t entry;  // position in the table of the shortest name that starts with the prefix
+};
+
+constexpr uint8_t TrieLeaf = 0x80;
+
+// a table defined with PGM_COMMAND_TABLE
+struct PgmTable : PgmCommands {
+  CommandFootprint footprint;
+
+  constexpr PgmTable(const ::Command* commands, uint16_t count, const CommandFootprint& footprint)
+    : PgmCommands{ commands, count }, footprint(footprint) {}
+};
+
+constexpr PgmCommands pgmCommands(const PgmTable& commands) {
+  return commands;
+}
+
+}
+
+#define PGM_COMMANDS(commands) impl::pgmCommands(commands)
+
+namespace impl {
+
+template<size_t count>
+constexpr uint16_t getCommandsCount(const ::Command (&)[count]) {
+  return count;
+}
+
+constexpr uint16_t getCommandsCount(const PgmTable& subcommands) {
+  return subcommands.count;
+}
+
+constexpr uint16_t getCommandsCount(decltype(nullptr)) {
+  return 0;
+}
+
+// NULL is an integer constant on most targets
+bool subcommands_must_be_a_command_table_or_nullptr();
+
+constexpr uint16_t getCommandsCount(int subcommands) {
+  return subcommands == 0 ? 0 : subcommands_must_be_a_command_table_or_nullptr();
+}
+
+constexpr uint16_t getCommandsCount(long subcommands) {
+  return subcommands == 0 ? 0 : subcommands_must_be_a_command_table_or_nullptr();
+}
+
+template<size_t count>
+constexpr const ::Command* getSubcommands(const ::Command (&subcommands)[count]) {
+  return subcommands;
+}
+
+constexpr const ::Command* getSubcommands(const PgmTable& subcommands) {
+  return subcommands.commands;
+}
+
+constexpr const ::Command* getSubcommands(decltype(nullptr)) {
+  return nullptr;
+}
+
+constexpr const ::Command* getSubcommands(int) {
+  return nullptr;
+}
+
+constexpr const ::Command* getSubcommands(long) {
+  return nullptr;
+}
+
+}
+
 #endif // STATIC_SERIAL_COMMANDS_COMMAND_H
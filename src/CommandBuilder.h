@@ -7,144 +7,558 @@ Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
 #ifndef STATIC_SERIAL_COMMANDS_COMMAND_BUILDER_H
 #define STATIC_SERIAL_COMMANDS_COMMAND_BUILDER_H
 
-#define _COMMAND(function, command, subcommands, description, argsCount, ...) \
-  impl::Command<sizeof(command), sizeof(description), argsCount> { \
-    impl::Command<sizeof(command), sizeof(description), argsCount>::_getCommandPgm, \
-    impl::Command<sizeof(command), sizeof(description), argsCount>::_getDescriptionPgm, \
-    impl::Command<sizeof(command), sizeof(description), argsCount>::_getArgsPgm, \
-    function, \
-    subcommands, \
-    sizeof(subcommands) / sizeof(Command), \
-    command, \
-    description, \
-    { __VA_ARGS__ } \
+#include <Arduino.h>
+#include "Command.h"
+
+namespace impl {
+
+// element index of a parameter pack
+template<size_t index>
+struct At {
+  template<typename T, typename... Rest>
+  static constexpr auto get(const T&, const Rest&... rest) -> decltype(At<index - 1>::get(rest...)) {
+    return At<index - 1>::get(rest...);
   }
+};
 
-#define _LINK_SUB_CMDS(cmd, subcommands) \
-  if (subcommands != nullptr) { \
-    for (uint16_t i = 0; i < sizeof(subcommands) / sizeof(Command); ++i) { \
-      Command* ptr = (Command*)subcommands + i; \
-      *ptr = Command(ptr->get(), &cmd); \
-    } \
+template<>
+struct At<0> {
+  template<typename T, typename... Rest>
+  static constexpr const T& get(const T& value, const Rest&...) {
+    return value;
   }
+};
 
-#define COMMAND_2(function, command) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, nullptr, "", 0); \
-    return Command(&cmd); }()
+template<size_t index, typename T, typename... Rest>
+struct TypeAt {
+  typedef typename TypeAt<index - 1, Rest...>::type type;
+};
 
-#define COMMAND_3(function, command, subcommands) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, subcommands, "", 0); \
-    _LINK_SUB_CMDS(cmd, subcommands); \
-    return Command(&cmd); }()
+template<typename T, typename... Rest>
+struct TypeAt<0, T, Rest...> {
+  typedef T type;
+};
 
-#define COMMAND_4(function, command, subcommands, description) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, subcommands, description, 0); \
-    _LINK_SUB_CMDS(cmd, subcommands); \
-    return Command(&cmd); }()
+template<typename T>
+struct IsRanged {
+  static constexpr bool value = false;
+};
 
-#define COMMAND_5(function, command, arg, subcommands, description) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, subcommands, description, 1, arg); \
-    _LINK_SUB_CMDS(cmd, subcommands); \
-    return Command(&cmd); }()
+template<>
+struct IsRanged<RangedArgConstraint> {
+  static constexpr bool value = true;
+};
 
-#define COMMAND_6(function, command, arg1, arg2, subcommands, description) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, subcommands, description, 2, arg1, arg2); \
-    _LINK_SUB_CMDS(cmd, subcommands); \
-    return Command(&cmd); }()
+constexpr uint8_t countRanged(size_t) {
+  return 0;
+}
 
-#define COMMAND_7(function, command, arg1, arg2, arg3, subcommands, description) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, subcommands, description, 3, arg1, arg2, arg3); \
-    _LINK_SUB_CMDS(cmd, subcommands); \
-    return Command(&cmd); }()
+// the number of ranged parameters among the first end ones
+template<typename... Rest>
+constexpr uint8_t countRanged(size_t end, bool ranged, Rest... rest) {
+  return end == 0 ? 0 : (ranged ? 1 : 0) + countRanged(end - 1, rest...);
+}
 
-#define COMMAND_8(function, command, arg1, arg2, arg3, arg4, subcommands, description) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, subcommands, description, 4, arg1, arg2, arg3, arg4); \
-    _LINK_SUB_CMDS(cmd, subcommands); \
-    return Command(&cmd); }()
+template<bool condition, typename Then, typename Else>
+struct Select {
+  typedef Then type;
+};
 
-#define COMMAND_9(function, command, arg1, arg2, arg3, arg4, arg5, subcommands, description) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, subcommands, description, 5, arg1, arg2, arg3, arg4, arg5); \
-    _LINK_SUB_CMDS(cmd, subcommands); \
-    return Command(&cmd); }()
+template<typename Then, typename Else>
+struct Select<false, Then, Else> {
+  typedef Else type;
+};
 
-#define COMMAND_10(function, command, arg1, arg2, arg3, arg4, arg5, arg6, subcommands, description) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, subcommands, description, 6, arg1, arg2, arg3, arg4, arg5, arg6); \
-    _LINK_SUB_CMDS(cmd, subcommands); \
-    return Command(&cmd); }()
+// the indices of the ranged parameters
+template<size_t index, typename Found, typename... Rest>
+struct RangedIndices {
+  typedef Found type;
+};
 
-#define COMMAND_11(function, command, arg1, arg2, arg3, arg4, arg5, arg6, arg7, subcommands, description) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, subcommands, description, 7, arg1, arg2, arg3, arg4, arg5, arg6, arg7); \
-    _LINK_SUB_CMDS(cmd, subcommands); \
-    return Command(&cmd); }()
+template<size_t index, size_t... found, typename T, typename... Rest>
+struct RangedIndices<index, Indices<found...>, T, Rest...>
+  : RangedIndices<index + 1, typename Select<IsRanged<T>::value, Indices<found..., index>, Indices<found...>>::type, Rest...> {};
 
-#define COMMAND_12(function, command, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, subcommands, description) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, subcommands, description, 8, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8); \
-    _LINK_SUB_CMDS(cmd, subcommands); \
-    return Command(&cmd); }()
+// The last two parameters are the subcommands and the description,
+// every parameter before them is an argument.
+template<size_t nameLength, typename... Rest>
+struct CommandLayout {
+  static constexpr size_t argCount = sizeof...(Rest) - 2;
+  static constexpr size_t descriptionLength = sizeof(typename TypeAt<argCount + 1, Rest...>::type);
+  static constexpr size_t rangeCount = countRanged(argCount, IsRanged<Rest>::value...);
+  typedef Command<nameLength, descriptionLength, argCount> accessors;
+  typedef Command<nameLength, descriptionLength, argCount, rangeCount> type;
+};
 
-#define COMMAND_13(function, command, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, subcommands, description) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, subcommands, description, 9, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9); \
-    _LINK_SUB_CMDS(cmd, subcommands); \
-    return Command(&cmd); }()
+// An argument without a range is stored as it is, the constraint of argument j with a range
+// gets the offset of its bounds, which are the k-th ranges of the command.
+template<typename Data>
+constexpr ArgConstraint storedArg(const ArgConstraint& argc, size_t, uint8_t) {
+  return argc;
+}
 
-#define COMMAND_14(function, command, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, arg10, subcommands, description) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, subcommands, description, 10, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, arg10); \
-    _LINK_SUB_CMDS(cmd, subcommands); \
-    return Command(&cmd); }()
+template<typename Data>
+constexpr ArgConstraint storedArg(const RangedArgConstraint& argc, size_t j, uint8_t k) {
+  return argc.withRange(offsetof(Data, ranges) + k * sizeof(ArgRange) - offsetof(Data, args) - j * sizeof(ArgConstraint));
+}
 
-#define COMMAND_15(function, command, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, arg10, arg11, subcommands, description) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, subcommands, description, 11, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, arg10, arg11); \
-    _LINK_SUB_CMDS(cmd, subcommands); \
-    return Command(&cmd); }()
+// These are not constexpr, a command that calls one of them doesn't compile
+// and the error names the rule that was broken.
+bool command_name_must_not_be_empty_or_contain_spaces();
+bool variadic_argument_must_be_the_last_argument();
 
-#define COMMAND_16(function, command, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, arg10, arg11, arg12, subcommands, description) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, subcommands, description, 12, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, arg10, arg11, arg12); \
-    _LINK_SUB_CMDS(cmd, subcommands); \
-    return Command(&cmd); }()
+constexpr bool isValidName(const char* name, size_t length) {
+  return length != 0 && (name[0] != ' ' && name[0] != '\0') && (length == 1 || isValidName(name + 1, length - 1));
+}
 
-#define COMMAND_17(function, command, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, arg10, arg11, arg12, arg13, subcommands, description) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, subcommands, description, 13, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, arg10, arg11, arg12, arg13); \
-    _LINK_SUB_CMDS(cmd, subcommands); \
-    return Command(&cmd); }()
+constexpr bool checkName(const char* name, size_t length) {
+  return isValidName(name, length) || command_name_must_not_be_empty_or_contain_spaces();
+}
 
-#define COMMAND_18(function, command, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, arg10, arg11, arg12, arg13, arg14, subcommands, description) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, subcommands, description, 14, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, arg10, arg11, arg12, arg13, arg14); \
-    _LINK_SUB_CMDS(cmd, subcommands); \
-    return Command(&cmd); }()
+constexpr bool checkArgs() {
+  return true;
+}
 
-#define COMMAND_19(function, command, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, arg10, arg11, arg12, arg13, arg14, arg15, subcommands, description) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, subcommands, description, 15, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, arg10, arg11, arg12, arg13, arg14, arg15); \
-    _LINK_SUB_CMDS(cmd, subcommands); \
-    return Command(&cmd); }()
+template<typename... Rest>
+constexpr bool checkArgs(const ArgConstraint& argc, const Rest&... rest) {
+  return (sizeof...(Rest) == 0 || argc.minCount == argc.maxCount || variadic_argument_must_be_the_last_argument()) && checkArgs(rest...);
+}
+
+template<typename Layout, size_t nameLength, typename Subcommands, size_t descriptionLength,
+         size_t... nameIndices, size_t... descriptionIndices, size_t... argIndices, size_t... rangeIndices, typename... Rest>
+constexpr typename Layout::type assembleCommand(void (*function)(SerialCommands&, Args&), const char (&name)[nameLength],
+                                                const Subcommands& subcommands, const char (&description)[descriptionLength],
+                                                Indices<nameIndices...>, Indices<descriptionIndices...>, Indices<argIndices...>,
+                                                Indices<rangeIndices...>, const Rest&... rest) {
+  typedef typename Layout::type Data;
+  typedef typename Layout::accessors Accessors;
+  return (void) (checkName(name, nameLength - 1) && checkArgs(ArgConstraint(At<argIndices>::get(rest...))...)),
+         Data{ Accessors::_getDescriptionPgm, Accessors::_getArgsPgm, function,
+               getSubcommands(subcommands), getCommandsCount(subcommands),
+               { name[nameIndices]... },
+               { description[descriptionIndices]... },
+               { storedArg<Data>(At<argIndices>::get(rest...), argIndices, countRanged(argIndices, IsRanged<Rest>::value...))... },
+               { At<rangeIndices>::get(rest...).bounds... } };
+}
+
+// makeCommand(function, name, arguments..., subcommands, description)
+template<size_t nameLength, typename Second, typename Third, typename... Rest>
+constexpr typename CommandLayout<nameLength, Second, Third, Rest...>::type makeCommand(void (*function)(SerialCommands&, Args&), const char (&name)[nameLength],
+                                                                                   const Second& second, const Third& third, const Rest&... rest) {
+  typedef CommandLayout<nameLength, Second, Third, Rest...> Layout;
+  return assembleCommand<Layout>(function, name,
+                                 At<Layout::argCount>::get(second, third, rest...), At<Layout::argCount + 1>::get(second, third, rest...),
+                                 typename MakeIndices<nameLength>::type(),
+                                 typename MakeIndices<Layout::descriptionLength>::type(),
+                                 typename MakeIndices<Layout::argCount>::type(),
+                                 typename RangedIndices<0, Indices<>, Second, Third, Rest...>::type(),
+                                 second, third, rest...);
+}
+
+template<size_t nameLength>
+constexpr Command<nameLength, 1, 0> makeCommand(void (*function)(SerialCommands&, Args&), const char (&name)[nameLength]) {
+  return makeCommand(function, name, nullptr, "");
+}
+
+template<size_t nameLength, typename Subcommands>
+constexpr Command<nameLength, 1, 0> makeCommand(void (*function)(SerialCommands&, Args&), const char (&name)[nameLength], const Subcommands& subcommands) {
+  return makeCommand(function, name, subcommands, "");
+}
+
+// a command in program memory that keeps its data visible to constant expressions
+struct PgmCommand {
+  const void* data;
+  const char* name;
+  const ArgConstraint* args;
+  uint8_t argCount;
+  uint16_t size;  // bytes of the command data
+  uint8_t nameLength;
+  uint16_t descriptionLength;
+  CommandFootprint subtree;  // of the subcommands
+
+  constexpr operator ::Command() const {
+    return ::Command(data);
+  }
+};
+
+template<uint8_t nameLength, uint16_t descriptionLength, uint8_t argCount, uint8_t rangeCount>
+constexpr PgmCommand pgmCommand(const Command<nameLength, descriptionLength, argCount, rangeCount>& data, const CommandFootprint& subtree) {
+  return PgmCommand{ &data, data.command, data.args, argCount, sizeof(data), nameLength, descriptionLength, subtree };
+}
+
+// not constexpr, see checkName
+CommandFootprint subcommands_of_a_pgm_command_must_be_a_pgm_command_table();
+
+constexpr CommandFootprint footprintOf(decltype(nullptr)) {
+  return CommandFootprint{};
+}
+
+constexpr CommandFootprint footprintOf(int) {
+  return CommandFootprint{};
+}
+
+constexpr CommandFootprint footprintOf(long) {
+  return CommandFootprint{};
+}
+
+constexpr CommandFootprint footprintOf(const PgmTable& table) {
+  return table.footprint;
+}
+
+template<size_t count>
+constexpr CommandFootprint footprintOf(const ::Command (&)[count]) {
+  return subcommands_of_a_pgm_command_must_be_a_pgm_command_table();
+}
+
+// the footprint of the subcommands, the parameters are the same as of makeCommand
+template<size_t nameLength>
+constexpr CommandFootprint subtreeOf(void (*)(SerialCommands&, Args&), const char (&)[nameLength]) {
+  return CommandFootprint{};
+}
+
+template<size_t nameLength, typename Subcommands>
+constexpr CommandFootprint subtreeOf(void (*)(SerialCommands&, Args&), const char (&)[nameLength], const Subcommands& subcommands) {
+  return footprintOf(subcommands);
+}
+
+template<size_t nameLength, typename Second, typename Third, typename... Rest>
+constexpr CommandFootprint subtreeOf(void (*)(SerialCommands&, Args&), const char (&)[nameLength],
+                                     const Second& second, const Third& third, const Rest&... rest) {
+  return footprintOf(At<sizeof...(Rest)>::get(second, third, rest...));
+}
+
+// not constexpr, see checkName, a table in program memory would be read as if it were in RAM
+bool subcommands_of_a_command_must_not_be_a_pgm_command_table();
+
+template<typename T>
+struct IsPgmTable {
+  static constexpr bool value = false;
+};
+
+template<>
+struct IsPgmTable<PgmTable> {
+  static constexpr bool value = true;
+};
+
+template<typename Subcommands>
+constexpr bool isRamTable(const Subcommands&) {
+  return !IsPgmTable<Subcommands>::value || subcommands_of_a_command_must_not_be_a_pgm_command_table();
+}
+
+// true unless the subcommands are a PGM_COMMAND_TABLE, the parameters are the same as of makeCommand
+template<size_t nameLength>
+constexpr bool ramSubcommands(void (*)(SerialCommands&, Args&), const char (&)[nameLength]) {
+  return true;
+}
+
+template<size_t nameLength, typename Subcommands>
+constexpr bool ramSubcommands(void (*)(SerialCommands&, Args&), const char (&)[nameLength], const Subcommands& subcommands) {
+  return isRamTable(subcommands);
+}
+
+template<size_t nameLength, typename Second, typename Third, typename... Rest>
+constexpr bool ramSubcommands(void (*)(SerialCommands&, Args&), const char (&)[nameLength],
+                              const Second& second, const Third& third, const Rest&... rest) {
+  return isRamTable(At<sizeof...(Rest)>::get(second, third, rest...));
+}
+
+constexpr bool equalNames(const char* a, const char* b) {
+  return *a == *b && (*a == '\0' || equalNames(a + 1, b + 1));
+}
+
+constexpr bool differsFromRest(const PgmCommand* commands, uint16_t count, uint16_t i, uint16_t k) {
+  return k == count || (!equalNames(commands[i].name, commands[k].name) && differsFromRest(commands, count, i, k + 1));
+}
 
-#define COMMAND_20(function, command, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, arg10, arg11, arg12, arg13, arg14, arg15, arg16, subcommands, description) []() { \
-    const static PROGMEM auto cmd = _COMMAND(function, command, subcommands, description, 16, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, arg10, arg11, arg12, arg13, arg14, arg15, arg16); \
-    _LINK_SUB_CMDS(cmd, subcommands); \
+constexpr bool distinctNames(const PgmCommand* commands, uint16_t count, uint16_t i = 0) {
+  return i == count || (differsFromRest(commands, count, i, i + 1) && distinctNames(commands, count, i + 1));
+}
+
+// bytes of an ARG name with its terminator
+constexpr uint16_t nameSize(PGM_P name, uint16_t i = 0) {
+  return name[i] == '\0' ? i + 1 : nameSize(name, i + 1);
+}
+
+// True if an argument before argument j of command i has the name. Names with the same
+// characters are the same Name, they are compared by content since addresses of objects
+// aren't constant expressions with -fno-delete-null-pointer-checks, which AVR always uses.
+constexpr bool earlierName(const PgmCommand* commands, uint16_t i, uint8_t j, PGM_P name) {
+  return j > 0 ? equalNames(commands[i].args[j - 1].name, name) || earlierName(commands, i, j - 1, name)
+               : i > 0 && earlierName(commands, i - 1, commands[i - 1].argCount, name);
+}
+
+constexpr uint16_t argNamesSize(const PgmCommand* commands, uint16_t count, uint16_t i = 0, uint8_t j = 0) {
+  return i == count ? 0
+         : j == commands[i].argCount ? argNamesSize(commands, count, i + 1, 0)
+         : (commands[i].args[j].name[0] != '\0' && !earlierName(commands, i, j, commands[i].args[j].name) ? nameSize(commands[i].args[j].name) : 0)
+           + argNamesSize(commands, count, i, j + 1);
+}
+
+constexpr bool sameLayout(const PgmCommand& a, const PgmCommand& b) {
+  return a.nameLength == b.nameLength && a.descriptionLength == b.descriptionLength && a.argCount == b.argCount;
+}
+
+constexpr bool earlierLayout(const PgmCommand* commands, uint16_t i, uint16_t k) {
+  return k < i && (sameLayout(commands[i], commands[k]) || earlierLayout(commands, i, k + 1));
+}
+
+constexpr uint16_t distinctLayouts(const PgmCommand* commands, uint16_t count, uint16_t i = 0) {
+  return i == count ? 0 : (earlierLayout(commands, i, 0) ? 0 : 1) + distinctLayouts(commands, count, i + 1);
+}
+
+constexpr uint32_t dataSize(const PgmCommand* commands, uint16_t count, uint16_t i = 0) {
+  return i == count ? 0 : commands[i].size + dataSize(commands, count, i + 1);
+}
+
+// arrays and variadic arguments count with their largest number of elements
+constexpr uint16_t argsOf(const PgmCommand& command, uint8_t j = 0) {
+  return j == command.argCount ? 0 : command.args[j].maxCount + argsOf(command, j + 1);
+}
+
+// evaluates each operand once, a compiler that doesn't cache constant calls would repeat them
+template<typename T>
+constexpr T larger(T a, T b) {
+  return a > b ? a : b;
+}
+
+// the arguments of the longest path that starts in the table
+constexpr uint16_t pathArgs(const PgmCommand* commands, uint16_t count, uint16_t i = 0) {
+  return i == count ? 0 : larger<uint16_t>(argsOf(commands[i]) + commands[i].subtree.maxArgs, pathArgs(commands, count, i + 1));
+}
+
+constexpr bool hasStringArg(const PgmCommand& command, uint8_t j = 0) {
+  return j < command.argCount && (command.args[j].type == ArgType::String || hasStringArg(command, j + 1));
+}
+
+constexpr bool hasStringArgs(const PgmCommand* commands, uint16_t count, uint16_t i = 0) {
+  return i < count && (hasStringArg(commands[i]) || commands[i].subtree.stringArgs || hasStringArgs(commands, count, i + 1));
+}
+
+template<typename T>
+constexpr T subtreeSum(const PgmCommand* commands, uint16_t count, T CommandFootprint::* field, uint16_t i = 0) {
+  return i == count ? 0 : commands[i].subtree.*field + subtreeSum(commands, count, field, i + 1);
+}
+
+template<typename T>
+constexpr T subtreeMax(const PgmCommand* commands, uint16_t count, T CommandFootprint::* field, uint16_t i = 0) {
+  return i == count ? 0 : larger<T>(commands[i].subtree.*field, subtreeMax(commands, count, field, i + 1));
+}
+
+// names compare as unsigned bytes, like SerialCommands does at run time
+constexpr bool lessName(const char* a, const char* b) {
+  return *a != *b ? (uint8_t) *a < (uint8_t) *b : *a != '\0' && lessName(a + 1, b + 1);
+}
+
+// the number of names that sort before the name of command k
+constexpr uint16_t rankOf(const PgmCommand* commands, uint16_t count, uint16_t k, uint16_t j = 0) {
+  return j == count ? 0 : (lessName(commands[j].name, commands[k].name) ? 1 : 0) + rankOf(commands, count, k, j + 1);
+}
+
+template<uint16_t count>
+struct Ranks {
+  uint16_t rank[count];
+};
+
+// the ranks are computed once, so a table of n commands takes n * n name comparisons
+template<uint16_t count, size_t... indices>
+constexpr Ranks<count> rankTable(const PgmCommand (&commands)[count], Indices<indices...>) {
+  return Ranks<count>{ { rankOf(commands, count, indices)... } };
+}
+
+// the command with the given rank, names are distinct
+template<uint16_t count>
+constexpr uint16_t withRank(const Ranks<count>& ranks, uint16_t rank, uint16_t k = 0) {
+  return k == count || ranks.rank[k] == rank ? k : withRank(ranks, rank, k + 1);
+}
+
+// not constexpr, see checkName, the length of a trie node leaves one bit for TrieLeaf
+bool command_names_in_program_memory_are_limited_to_127_characters();
+
+constexpr bool checkTrieNames(const PgmCommand* commands, uint16_t count, uint16_t i = 0) {
+  return i == count || ((commands[i].nameLength - 1 < TrieLeaf || command_names_in_program_memory_are_limited_to_127_characters())
+                        && checkTrieNames(commands, count, i + 1));
+}
+
+constexpr uint8_t commonLength(const char* a, const char* b, uint8_t i = 0) {
+  return a[i] != '\0' && a[i] == b[i] ? commonLength(a, b, i + 1) : i;
+}
+
+// the names in the order of their ranks, the trie of the table is built from them
+template<uint16_t count>
+struct SortedNames {
+  uint16_t order[count];  // the command of each rank
+  uint8_t length[count];
+  uint8_t common[count];  // characters shared with the name of the next rank, 0 for the last one
+};
+
+template<uint16_t count, size_t... indices>
+constexpr SortedNames<count> sortNames(const PgmCommand (&commands)[count], const Ranks<count>& ranks, Indices<indices...>) {
+  return SortedNames<count>{ { withRank(ranks, indices)... },
+                             { (uint8_t) (commands[withRank(ranks, indices)].nameLength - 1)... },
+                             { (uint8_t) (indices + 1 < count ? commonLength(commands[withRank(ranks, indices)].name,
+                                                                              commands[withRank(ranks, indices + 1)].name) : 0)... } };
+}
+
+// The nodes of the trie that a rank adds are the prefixes of its name that are longer than
+// the prefix it shares with the name before it. Those are the prefixes it shares with the names
+// after it, up to the first name that shares less, and the whole name.
+template<uint16_t count>
+constexpr uint8_t floorOf(const SortedNames<count>& names, uint16_t r) {
+  return r == 0 ? 0 : names.common[r - 1];
+}
+
+// the shortest node of rank r longer than x, shortest starts as the length of the name
+template<uint16_t count>
+constexpr uint8_t nextLength(const SortedNames<count>& names, uint16_t q, uint8_t x, uint8_t shortest) {
+  return names.common[q] > x ? nextLength(names, q + 1, x, names.common[q] < shortest ? names.common[q] : shortest) : shortest;
+}
+
+template<uint16_t count>
+constexpr uint8_t lengthsFrom(const SortedNames<count>& names, uint16_t r, uint8_t x) {
+  return x == names.length[r] ? 0 : 1 + lengthsFrom(names, r, nextLength(names, r, x, names.length[r]));
+}
+
+// the length of the node j of rank r, from the shortest one
+template<uint16_t count>
+constexpr uint8_t lengthAt(const SortedNames<count>& names, uint16_t r, uint8_t j, uint8_t x) {
+  return j == 0 ? nextLength(names, r, x, names.length[r]) : lengthAt(names, r, j - 1, nextLength(names, r, x, names.length[r]));
+}
+
+template<uint16_t count>
+struct TrieShape {
+  SortedNames<count> names;
+  uint8_t nodes[count];  // nodes added by each rank
+};
+
+template<uint16_t count, size_t... indices>
+constexpr TrieShape<count> trieShape(const SortedNames<count>& names, Indices<indices...>) {
+  return TrieShape<count>{ names, { (uint8_t) (count == 1 ? 0 : lengthsFrom(names, indices, floorOf(names, indices)))... } };
+}
+
+// the nodes of each rank follow the root and the nodes of the ranks before it,
+// the root of a table of one command is a leaf of its name
+template<uint16_t count>
+constexpr uint16_t firstNode(const TrieShape<count>& shape, uint16_t r) {
+  return r == 0 ? 1 : firstNode(shape, r - 1) + shape.nodes[r - 1];
+}
+
+template<uint16_t count>
+struct TrieLayout {
+  TrieShape<count> shape;
+  uint16_t first[count + 1];  // first node of each rank, first[count] is the number of nodes
+};
+
+template<uint16_t count, size_t... indices>
+constexpr TrieLayout<count> trieLayout(const TrieShape<count>& shape, Indices<indices...>) {
+  return TrieLayout<count>{ shape, { firstNode(shape, indices)..., firstNode(shape, count) } };
+}
+
+template<uint16_t count>
+constexpr uint16_t trieSize(const TrieLayout<count>& layout) {
+  return layout.first[count];
+}
+
+template<uint16_t count>
+constexpr uint16_t rankOfNode(const TrieLayout<count>& layout, uint16_t i, uint16_t r = 0) {
+  return r + 1 < count && layout.first[r + 1] <= i ? rankOfNode(layout, i, r + 1) : r;
+}
+
+// the rank after the last name that starts with the prefix of length of name q
+template<uint16_t count>
+constexpr uint16_t prefixEnd(const SortedNames<count>& names, uint16_t q, uint8_t length) {
+  return q + 1 < count && names.common[q] >= length ? prefixEnd(names, q + 1, length) : q + 1;
+}
+
+// the next child of the parent starts at the first rank after the prefix if that rank shares the parent's prefix
+template<uint16_t count>
+constexpr uint16_t nextSibling(const TrieLayout<count>& layout, uint16_t end, uint8_t parent) {
+  return end < count && layout.shape.names.common[end - 1] >= parent ? layout.first[end] : 0;
+}
+
+template<uint16_t count>
+constexpr TrieNode trieNode(const PgmCommand* commands, const TrieLayout<count>& layout, uint16_t r, uint8_t j, uint8_t parent, uint8_t length) {
+  return TrieNode{ commands[layout.shape.names.order[r]].name[parent],
+                   (uint8_t) (length | (j + 1 == layout.shape.nodes[r] && (r + 1 == count || layout.shape.names.common[r] < length) ? TrieLeaf : 0)),
+                   nextSibling(layout, prefixEnd(layout.shape.names, r, length), parent),
+                   layout.shape.names.order[r] };
+}
+
+template<uint16_t count>
+constexpr TrieNode trieNode(const PgmCommand* commands, const TrieLayout<count>& layout, uint16_t r, uint8_t j) {
+  return trieNode(commands, layout, r, j,
+                  j == 0 ? floorOf(layout.shape.names, r) : lengthAt(layout.shape.names, r, j - 1, floorOf(layout.shape.names, r)),
+                  lengthAt(layout.shape.names, r, j, floorOf(layout.shape.names, r)));
+}
+
+template<uint16_t count>
+constexpr TrieNode trieNode(const PgmCommand* commands, const TrieLayout<count>& layout, uint16_t i) {
+  return i == 0 ? TrieNode{ '\0', (uint8_t) (count == 1 ? layout.shape.names.length[0] | TrieLeaf : 0), 0, layout.shape.names.order[0] }
+                : trieNode(commands, layout, rankOfNode(layout, i), (uint8_t) (i - layout.first[rankOfNode(layout, i)]));
+}
+
+// the entries of a table in program memory followed by the trie of their names,
+// SerialCommands finds the trie at the end of the entries
+template<uint16_t count, uint16_t nodeCount>
+struct IndexedTable {
+  ::Command entries[count];
+  TrieNode trie[nodeCount];
+};
+
+template<uint16_t nodeCount, uint16_t count, size_t... indices, size_t... nodes>
+constexpr IndexedTable<count, nodeCount> indexTable(const PgmCommand (&commands)[count], const TrieLayout<count>& layout,
+                                                    Indices<indices...>, Indices<nodes...>) {
+  return IndexedTable<count, nodeCount>{ { commands[indices]... }, { trieNode(commands, layout, nodes)... } };
+}
+
+// the footprint of the table and the subtrees of its commands
+constexpr CommandFootprint tableFootprint(const PgmCommand* commands, uint16_t count, uint16_t nodeCount) {
+  return CommandFootprint{ (uint16_t) (count + subtreeSum(commands, count, &CommandFootprint::commands)),
+                           (uint32_t) (dataSize(commands, count) + count * sizeof(::Command) + nodeCount * sizeof(TrieNode) + argNamesSize(commands, count))
+                             + subtreeSum(commands, count, &CommandFootprint::flashBytes),
+                           (uint16_t) (distinctLayouts(commands, count) + subtreeSum(commands, count, &CommandFootprint::layouts)),
+                           pathArgs(commands, count),
+                           (uint8_t) (subtreeMax(commands, count, &CommandFootprint::depth) + 1),
+                           hasStringArgs(commands, count) };
+}
+
+}
+
+// COMMAND(function, name, arguments..., subcommands, description)
+// Command data is in program memory, built at compile time, the returned Command is kept in a table in RAM.
+// Its subcommands must be a table in RAM as well.
+#define COMMAND(...) []() { \
+    static_assert(impl::ramSubcommands(__VA_ARGS__), "subcommands of a COMMAND must be a table in RAM"); \
+    constexpr static PROGMEM auto cmd = impl::makeCommand(__VA_ARGS__); \
     return Command(&cmd); }()
 
-#define COMMAND_X(a0, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11, a12, a13, a14, a15, a16, a17, a18, a19, a20, FUNC, ...)  FUNC
-
-#define COMMAND(...) \
-  COMMAND_X(, ##__VA_ARGS__, \
-              COMMAND_20(__VA_ARGS__), \
-              COMMAND_19(__VA_ARGS__), \
-              COMMAND_18(__VA_ARGS__), \
-              COMMAND_17(__VA_ARGS__), \
-              COMMAND_16(__VA_ARGS__), \
-              COMMAND_15(__VA_ARGS__), \
-              COMMAND_14(__VA_ARGS__), \
-              COMMAND_13(__VA_ARGS__), \
-              COMMAND_12(__VA_ARGS__), \
-              COMMAND_11(__VA_ARGS__), \
-              COMMAND_10(__VA_ARGS__), \
-              COMMAND_9(__VA_ARGS__), \
-              COMMAND_8(__VA_ARGS__), \
-              COMMAND_7(__VA_ARGS__), \
-              COMMAND_6(__VA_ARGS__), \
-              COMMAND_5(__VA_ARGS__), \
-              COMMAND_4(__VA_ARGS__), \
-              COMMAND_3(__VA_ARGS__), \
-              COMMAND_2(__VA_ARGS__) \
-             )
+// defines a constant Command with its data in program memory, for tables in program memory,
+// its subcommands must be a PGM_COMMAND_TABLE:
+//   PGM_COMMAND(cmdLed, cmd_led, "led", ArgType::Int, nullptr, "set led");
+#define PGM_COMMAND(name, ...) \
+  constexpr PROGMEM auto name##_data = impl::makeCommand(__VA_ARGS__); \
+  constexpr impl::PgmCommand name = impl::pgmCommand(name##_data, impl::subtreeOf(__VA_ARGS__))
+
+// A table in program memory of commands defined with PGM_COMMAND, their names are checked to be distinct.
+// The entries keep their order, a trie of the names is built at compile time and stored after them,
+// so a name is looked up in the time of its length. The table can be passed to SerialCommands, listCommands and
+// as subcommands of a PGM_COMMAND, table_footprint is the CommandFootprint of its tree:
+//   PGM_COMMAND_TABLE(commands, cmdLed, cmdHelp);
+#define PGM_COMMAND_TABLE(table, ...) \
+  constexpr impl::PgmCommand table##_commands[] { __VA_ARGS__ }; \
+  static_assert(impl::distinctNames(table##_commands, sizeof(table##_commands) / sizeof(impl::PgmCommand)), \
+                "command names in " #table " must be distinct"); \
+  static_assert(impl::checkTrieNames(table##_commands, sizeof(table##_commands) / sizeof(impl::PgmCommand)), \
+                "command names in " #table " are too long"); \
+  constexpr auto table##_ranks = impl::rankTable(table##_commands, \
+    impl::MakeIndices<sizeof(table##_commands) / sizeof(impl::PgmCommand)>::type()); \
+  constexpr auto table##_trie = impl::trieLayout(impl::trieShape( \
+    impl::sortNames(table##_commands, table##_ranks, impl::MakeIndices<sizeof(table##_commands) / sizeof(impl::PgmCommand)>::type()), \
+    impl::MakeIndices<sizeof(table##_commands) / sizeof(impl::PgmCommand)>::type()), \
+    impl::MakeIndices<sizeof(table##_commands) / sizeof(impl::PgmCommand)>::type()); \
+  constexpr PROGMEM auto table##_entries = impl::indexTable<impl::trieSize(table##_trie)>(table##_commands, table##_trie, \
+    impl::MakeIndices<sizeof(table##_commands) / sizeof(impl::PgmCommand)>::type(), impl::MakeIndices<impl::trieSize(table##_trie)>::type()); \
+  constexpr CommandFootprint table##_footprint = impl::tableFootprint(table##_commands, sizeof(table##_commands) / sizeof(impl::PgmCommand), \
+    impl::trieSize(table##_trie)); \
+  constexpr impl::PgmTable table { table##_entries.entries, sizeof(table##_commands) / sizeof(impl::PgmCommand), table##_footprint }
 
 #endif // STATIC_SERIAL_COMMANDS_COMMAND_BUILDER_H
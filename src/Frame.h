@@ -0,0 +1,58 @@
+/*---------------------------------------------------------------------
+Author         : naszly
+License        : BSD
+Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
+-----------------------------------------------------------------------*/
+
+#ifndef STATIC_SERIAL_COMMANDS_FRAME_H
+#define STATIC_SERIAL_COMMANDS_FRAME_H
+
+#include <Arduino.h>
+
+#define CMD_FRAME_SYNC 0x02
+
+// sync byte, length byte, payload, 16 bit crc (big endian)
+#define CMD_FRAME_OVERHEAD 4
+
+enum class FrameStatus : uint8_t {
+  Ok,
+  UnknownCommand,
+  NotEnoughArguments,
+  TooManyArguments,
+  ArgumentOutOfRange,
+  InvalidArgument,
+  BadChecksum,
+  FrameTooLong,
+  QueueFull,
+  BufferOverflow,   // text lines only
+  TooManyCommands,  // text lines only
+  Data = 0x80
+};
+
+namespace frame {
+
+// CRC-16/CCITT-FALSE
+inline uint16_t crc16(uint16_t crc, uint8_t data) {
+  crc ^= (uint16_t) data << 8;
+  for (uint8_t i = 0; i < 8; ++i) {
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+inline uint16_t crc16(const uint8_t* data, uint16_t length, uint16_t crc = 0xFFFF) {
+  while (length--) {
+    crc = crc16(crc, *data++);
+  }
+  return crc;
+}
+
+// little endian, independent of the target byte order
+inline uint32_t readUInt32(const uint8_t* data) {
+  return (uint32_t) data[0] | (uint32_t) data[1] << 8 |
+         (uint32_t) data[2] << 16 | (uint32_t) data[3] << 24;
+}
+
+}
+
+#endif // STATIC_SERIAL_COMMANDS_FRAME_H
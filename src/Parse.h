@@ -11,46 +11,199 @@ Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
 
 namespace parse {
 
-bool strtou(const char* str, uint32_t* out) {
+// Four digits are converted at once where 32 bit multiplies are cheap and bytes load
+// little endian, AVR multiplies 32 bit values in a library call and takes two digits per step.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && !defined(__AVR__)
+#define CMD_PARSE_SWAR 1
+#else
+#define CMD_PARSE_SWAR 0
+#endif
+
+#if CMD_PARSE_SWAR
+// the value of four ASCII digits, false if one of them isn't a digit
+inline bool digits4(const char* str, uint32_t* out) {
+  uint32_t v;
+  memcpy(&v, str, sizeof(v));
+  // every byte has to be 0x30 - 0x39: the high nibble is 3 and adding 6 doesn't carry into it
+  if (((v & 0xF0F0F0F0u) | (((v + 0x06060606u) & 0xF0F0F0F0u) >> 4)) != 0x33333333u) return false;
+  v &= 0x0F0F0F0Fu;
+  v = (v * 10 + (v >> 8)) & 0x00FF00FFu;  // pairs of digits, the first byte is the first digit
+  *out = (v * 100 + (v >> 16)) & 0xFFFFu;
+  return true;
+}
+#endif
+
+// up to 9 decimal digits always fit into 32 bits, only the 10th digit is checked
+inline bool strtodec(const char* str, uint16_t len, uint32_t* out) {
+  while (len > 1 && *str == '0') {
+    str++;
+    len--;
+  }
+  if (len == 0 || len > 10) return false;
+
+  uint16_t fast = len < 9 ? len : 9;
   uint32_t value = 0;
-  for (int i = 0; str[i] != '\0'; ++i) {
+  uint16_t i = 0;
+#if CMD_PARSE_SWAR
+  for (; i + 4 <= fast; i += 4) {
+    uint32_t chunk;
+    if (!digits4(str + i, &chunk)) return false;
+    value = value * 10000 + chunk;
+  }
+#else
+  for (; i + 2 <= fast; i += 2) {
+    uint8_t d0 = str[i] - '0';
+    uint8_t d1 = str[i + 1] - '0';
+    if (d0 > 9 || d1 > 9) return false;
+    value = value * 100 + (uint8_t) (d0 * 10 + d1);
+  }
+#endif
+  for (; i < fast; ++i) {
     uint8_t d = str[i] - '0';
     if (d > 9) return false;
-    uint32_t tmp = value;
     value = value * 10 + d;
-    if (tmp > value) return false;  // overflow
+  }
+
+  if (len == 10) {
+    uint8_t d = str[9] - '0';
+    if (d > 9) return false;
+    if (value > UINT32_MAX / 10 || (value == UINT32_MAX / 10 && d > UINT32_MAX % 10)) return false;  // overflow
+    value = value * 10 + d;
   }
   *out = value;
   return true;
 }
 
-bool strtoi(const char* str, int32_t* out) {
-  int32_t value = 0;
-  int i = 0;
-  int32_t sign = 1;
-  if (str[i] == '-') {
-    sign = -1;
-    ++i;
-  } else if (str[i] == '+') {
-    ++i;
+// base 2 or 16, shift is the number of bits per digit
+inline bool strtobits(const char* str, uint16_t len, uint8_t shift, uint32_t* out) {
+  while (len > 1 && *str == '0') {
+    str++;
+    len--;
   }
+  if (len == 0 || len > 32 / shift) return false;  // overflow
 
-  for (; str[i] != '\0'; ++i) {
-    uint8_t d = str[i] - '0';
-    if (d > 9) return false;
-    int32_t tmp = value;
-    value = value * 10 + d;
-    if (tmp > value) return false;  // overflow
+  uint32_t value = 0;
+  for (uint16_t i = 0; i < len; ++i) {
+    uint8_t c = str[i];
+    uint8_t d = c - '0';
+    if (d > 9) {
+      d = (c | 0x20) - 'a' + 10;  // lower case
+      if (d < 10) d = 0xFF;
+    }
+    if (d >= (1 << shift)) return false;
+    value = (value << shift) | d;
+  }
+  *out = value;
+  return true;
+}
+
+// decimal, 0x hexadecimal or 0b binary
+inline bool strtou(const char* str, uint16_t len, uint32_t* out) {
+  if (len > 2 && str[0] == '0') {
+    if (str[1] == 'x' || str[1] == 'X')
+      return strtobits(str + 2, len - 2, 4, out);
+    if (str[1] == 'b' || str[1] == 'B')
+      return strtobits(str + 2, len - 2, 1, out);
+  }
+  return strtodec(str, len, out);
+}
+
+inline bool strtoi(const char* str, uint16_t len, int32_t* out) {
+  bool negative = false;
+  if (len > 0 && (str[0] == '-' || str[0] == '+')) {
+    negative = str[0] == '-';
+    ++str;
+    --len;
   }
-  *out = value * sign;
+
+  uint32_t value;
+  if (!strtou(str, len, &value)) return false;
+  if (value > (uint32_t) INT32_MAX + negative) return false;  // overflow
+  *out = negative ? (int32_t) (0u - value) : (int32_t) value;
   return true;
 }
 
-bool strtof(const char* str, float* out) {
-  char* str_end = nullptr;
-  *out = (float)strtod(str, &str_end);
-  if (*out == 0.0f && str_end == str)
-    return false;
+// Decimal to float with 9 significant digits, enough for a 24 bit mantissa.
+// The whole slice has to be a number: [+-]digits[.digits][(e|E)[+-]digits]
+inline bool strtof(const char* str, uint16_t len, float* out) {
+  static const float powers[] PROGMEM = {
+    1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f,
+    1e10f, 1e11f, 1e12f, 1e13f, 1e14f, 1e15f, 1e16f, 1e17f, 1e18f, 1e19f,
+    1e20f, 1e21f, 1e22f, 1e23f, 1e24f, 1e25f, 1e26f, 1e27f, 1e28f, 1e29f,
+    1e30f, 1e31f, 1e32f, 1e33f, 1e34f, 1e35f, 1e36f, 1e37f, 1e38f
+  };
+  const int16_t maxPower = sizeof(powers) / sizeof(powers[0]) - 1;
+
+  const char* const end = str + len;
+  bool negative = false;
+  if (str < end && (*str == '-' || *str == '+')) {
+    negative = *str++ == '-';
+  }
+
+  uint32_t mantissa = 0;
+  int16_t exponent = 0;
+  uint8_t significant = 0;
+  bool digits = false;
+
+  for (; str < end; ++str) {
+    uint8_t d = *str - '0';
+    if (d > 9) break;
+    digits = true;
+    if (significant < 9) {
+      mantissa = mantissa * 10 + d;
+      if (mantissa != 0) significant++;
+    } else {
+      exponent++;
+    }
+  }
+
+  if (str < end && *str == '.') {
+    for (++str; str < end; ++str) {
+      uint8_t d = *str - '0';
+      if (d > 9) break;
+      digits = true;
+      if (significant < 9) {
+        mantissa = mantissa * 10 + d;
+        exponent--;
+        if (mantissa != 0) significant++;
+      }
+    }
+  }
+
+  if (!digits) return false;
+
+  if (str < end && (*str == 'e' || *str == 'E')) {
+    ++str;
+    bool negativeExponent = false;
+    if (str < end && (*str == '-' || *str == '+')) {
+      negativeExponent = *str++ == '-';
+    }
+    if (str == end) return false;
+    int16_t e = 0;
+    for (; str < end; ++str) {
+      uint8_t d = *str - '0';
+      if (d > 9) return false;
+      if (e < 1000) e = e * 10 + d;
+    }
+    exponent += negativeExponent ? -e : e;
+  }
+
+  if (str != end) return false;
+
+  float value = (float) mantissa;
+  if (mantissa != 0) {
+    if (exponent > 0) {
+      if (exponent > maxPower) return false;  // overflow
+      value *= pgm_read_float(&powers[exponent]);
+      if (isinf(value)) return false;
+    } else {
+      for (; exponent < -maxPower; exponent += maxPower) {
+        value /= pgm_read_float(&powers[maxPower]);
+      }
+      value /= pgm_read_float(&powers[-exponent]);
+    }
+  }
+  *out = negative ? -value : value;
   return true;
 }
 
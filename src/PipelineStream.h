@@ -0,0 +1,78 @@
+/*---------------------------------------------------------------------
+Author         : naszly
+License        : BSD
+Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
+-----------------------------------------------------------------------*/
+
+#ifndef STATIC_SERIAL_COMMANDS_PIPELINE_STREAM_H
+#define STATIC_SERIAL_COMMANDS_PIPELINE_STREAM_H
+
+#include <Arduino.h>
+#include "ReceiveRing.h"
+
+// Stream wrapper for a SerialCommands object whose queued commands run on
+// another core (see SerialCommands::enableQueue). The receiving core calls
+// readSerial and drain, the executing core calls poll. Reading is passed
+// through to the wrapped stream. Output written on the executing core goes
+// through a ring and is sent by drain, output of the receiving core is sent directly.
+class PipelineStream : public Stream {
+  public:
+    // true on the core or thread that calls poll
+    typedef bool (*CorePredicate)();
+
+    template<size_t size>
+    PipelineStream(Stream& stream, uint8_t (&buffer)[size], CorePredicate isExecutingCore)
+      : stream(stream), responses(buffer), isExecutingCore(isExecutingCore) {}
+
+    int available() override {
+      return stream.available();
+    }
+
+    int read() override {
+      return stream.read();
+    }
+
+    int peek() override {
+      return stream.peek();
+    }
+
+    size_t write(uint8_t c) override {
+      return write(&c, 1);
+    }
+
+    // the executing core waits while the ring is full
+    size_t write(const uint8_t* data, size_t size) override {
+      if (!isExecutingCore())
+        return stream.write(data, size);
+      size_t count = 0;
+      while (count < size) {
+        uint16_t length = size - count > UINT16_MAX ? UINT16_MAX : size - count;
+        count += responses.push(data + count, length);
+        if (count < size) yield();
+      }
+      return size;
+    }
+
+    using Print::write;
+
+    // receiving core, sends the output of the executing core
+    void drain() {
+      char chunk[32];
+      uint16_t count;
+      while ((count = responses.read(chunk, sizeof(chunk))) != 0) {
+        stream.write(chunk, count);
+      }
+    }
+
+    // receiving core, true if output of the executing core is waiting
+    bool isPending() {
+      return responses.available() != 0;
+    }
+
+  private:
+    Stream& stream;
+    ReceiveRing responses;
+    const CorePredicate isExecutingCore;
+};
+
+#endif // STATIC_SERIAL_COMMANDS_PIPELINE_STREAM_H
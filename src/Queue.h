@@ -0,0 +1,67 @@
+/*---------------------------------------------------------------------
+Author         : naszly
+License        : BSD
+Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
+-----------------------------------------------------------------------*/
+
+#ifndef STATIC_SERIAL_COMMANDS_QUEUE_H
+#define STATIC_SERIAL_COMMANDS_QUEUE_H
+
+#include <Arduino.h>
+#include "Command.h"
+#ifdef __AVR__
+#include <util/atomic.h>
+#endif
+
+namespace impl {
+
+// The queue indices are 16 bit. On 8 bit targets GCC would call the
+// __atomic library functions for them, so interrupts are held off
+// for the two byte copy instead, see RingIndex for the ring.
+inline uint16_t loadIndex(const uint16_t* index) {
+#ifdef __AVR__
+  uint16_t value;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    value = *(const volatile uint16_t*) index;
+  }
+  return value;
+#else
+  return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+#endif
+}
+
+inline void storeIndex(uint16_t* index, uint16_t value) {
+#ifdef __AVR__
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    *(volatile uint16_t*) index = value;
+  }
+#else
+  __atomic_store_n(index, value, __ATOMIC_RELEASE);
+#endif
+}
+
+// A command waiting for SerialCommands::poll, followed by its arguments
+// and the characters of its string arguments. Records are stored one
+// after the other in the queue buffer, string arguments point into their record.
+// A record never wraps around the end of the buffer, the room left there
+// is covered by a Skip record if it is large enough to hold one.
+struct QueuedCommand {
+  enum Flags : uint8_t {
+    BatchEnd = 1,  // print the batch status after the command
+    Frame = 2,     // reply with a frame after the command
+    Skip = 4       // no command, the next record is at the start of the buffer
+  };
+
+  ::Command command;
+  uint16_t size;  // bytes of the record, a multiple of the alignment of QueuedCommand
+  uint8_t argCount;
+  uint8_t flags;
+
+  Arg* getArgs() {
+    return reinterpret_cast<Arg*>(this + 1);
+  }
+};
+
+}
+
+#endif // STATIC_SERIAL_COMMANDS_QUEUE_H
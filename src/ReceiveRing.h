@@ -0,0 +1,90 @@
+/*---------------------------------------------------------------------
+Author         : naszly
+License        : BSD
+Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
+-----------------------------------------------------------------------*/
+
+#ifndef STATIC_SERIAL_COMMANDS_RECEIVE_RING_H
+#define STATIC_SERIAL_COMMANDS_RECEIVE_RING_H
+
+#include <Arduino.h>
+
+namespace impl {
+
+// indices are read and written in a single instruction on 8 bit targets
+#ifdef __AVR__
+typedef uint8_t RingIndex;
+#else
+typedef uint16_t RingIndex;
+#endif
+
+}
+
+// Lock-free single producer, single consumer byte ring. The producer
+// (a receive interrupt or another thread) pushes, SerialCommands reads
+// it instead of the stream, see SerialCommands::setReceiveRing.
+// The indices run freely and are masked on access, the size is a power of two.
+class ReceiveRing {
+  public:
+    template<size_t size>
+    explicit ReceiveRing(uint8_t (&buffer)[size])
+      : buffer(buffer), mask(size - 1) {
+      static_assert(size >= 2 && (size & (size - 1)) == 0, "ReceiveRing size must be a power of two");
+      static_assert(size <= (impl::RingIndex) -1 / 2 + 1, "ReceiveRing is too large for the index type");
+    }
+
+    // producer side, returns false and counts the byte as dropped if the ring is full
+    bool push(uint8_t c) {
+      impl::RingIndex h = head;
+      if ((impl::RingIndex) (h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) > mask) {
+        dropped++;
+        return false;
+      }
+      buffer[h & mask] = c;
+      __atomic_store_n(&head, (impl::RingIndex) (h + 1), __ATOMIC_RELEASE);
+      return true;
+    }
+
+    // producer side, returns the number of bytes pushed
+    uint16_t push(const uint8_t* data, uint16_t length) {
+      uint16_t count = 0;
+      while (count < length && push(data[count])) count++;
+      return count;
+    }
+
+    // consumer side
+    uint16_t available() const {
+      return (impl::RingIndex) (__atomic_load_n(&head, __ATOMIC_ACQUIRE) - tail);
+    }
+
+    // consumer side, copies at most two contiguous runs
+    uint16_t read(char* data, uint16_t length) {
+      impl::RingIndex t = tail;
+      uint16_t count = (impl::RingIndex) (__atomic_load_n(&head, __ATOMIC_ACQUIRE) - t);
+      if (count > length) count = length;
+      uint16_t first = mask + 1 - (t & mask);
+      if (first > count) first = count;
+      memcpy(data, buffer + (t & mask), first);
+      memcpy(data + first, buffer, count - first);
+      __atomic_store_n(&tail, (impl::RingIndex) (t + count), __ATOMIC_RELEASE);
+      return count;
+    }
+
+    uint16_t getSize() const {
+      return mask + 1;
+    }
+
+    // bytes lost because the ring was full, written by the producer
+    uint32_t getDropped() {
+      return dropped;
+    }
+
+  private:
+    uint8_t* const buffer;
+    const uint16_t mask;
+    impl::RingIndex head = 0;  // written by the producer
+    impl::RingIndex tail = 0;  // written by the consumer
+    volatile uint32_t dropped = 0;
+};
+
+#endif // STATIC_SERIAL_COMMANDS_RECEIVE_RING_H
@@ -8,21 +8,34 @@ Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
 #include "StaticSerialCommands.h"
 
 void SerialCommands::printCommand(const Command& command) {
-  if (command.hasParent()) {
-    printCommand(command.getParent());
+  Command parent = findParent(commands, commandsCount, command);
+  if (parent) {
+    printCommand(parent);
     serial.print(' ');
   }
 
+  printCommandSyntax(command);
+}
+
+// name and arguments without the parent commands
+void SerialCommands::printCommandSyntax(const Command& command) {
   printFromPgm(command.getCommandPgm());
 
   uint8_t count = 0;
   const impl::ArgConstraint* argcs = command.getArgsPgm(&count);
-  impl::ArgConstraint argc;
   for (uint16_t j = 0; j < count; ++j) {
-    memcpy_P(&argc, &argcs[j], sizeof(impl::ArgConstraint));
     serial.print(' ');
     serial.print('<');
-    printFromPgm(argc.getNamePgm());
+    printFromPgm(argcs[j].getNamePgm());
+    uint8_t minCount = argcs[j].getMinCount();
+    uint8_t maxCount = argcs[j].getMaxCount();
+    if (minCount != maxCount) {
+      serial.print(F("..."));
+    } else if (maxCount != 1) {
+      serial.print('[');
+      serial.print(maxCount);
+      serial.print(']');
+    }
     serial.print('>');
   }
 }
@@ -31,200 +44,1403 @@ void SerialCommands::printCommandDescription(const Command& command) {
   printFromPgm(command.getDescriptionPgm());
 }
 
-void SerialCommands::listCommands(const Command* commands, uint16_t commandsCount) {
+// parent links are not stored, the tree is searched when a command is printed
+Command SerialCommands::findParent(const Command* commands, uint16_t commandsCount, const Command& command) {
+  const Command* subcmds;
+  uint16_t subcmdCount;
   for (uint16_t i = 0; i < commandsCount; ++i) {
-    printCommand(commands[i]);
-    serial.print(F(" - "));
-    printCommandDescription(commands[i]);
-    serial.println();
+    Command cmd = getCommand(commands, i);
+    subcmds = nullptr;
+    cmd.getSubCommands(&subcmds, &subcmdCount);
+    if (subcmds == nullptr)
+      continue;
+    for (uint16_t j = 0; j < subcmdCount; ++j) {
+      if (getCommand(subcmds, j) == command)
+        return cmd;
+    }
+    Command parent = findParent(subcmds, subcmdCount, command);
+    if (parent)
+      return parent;
   }
+  return Command();
+}
+
+void SerialCommands::listCommands(const Command* commands, uint16_t commandsCount) {
+  startListing(commands, commandsCount, false);
 }
 
 void SerialCommands::listAllCommands(const Command* commands, uint16_t commandsCount) {
-  const Command* subcmds;
-  uint16_t subcmdCount;
-  for (uint16_t i = 0; i < commandsCount; ++i) {
-    printCommand(commands[i]);
-    serial.print(F(" - "));
-    printCommandDescription(commands[i]);
-    serial.println();
+  startListing(commands, commandsCount, true);
+}
 
-    subcmds = nullptr;
-    commands[i].getSubCommands(&subcmds, &subcmdCount);
-    if (subcmds != nullptr) {
-      listAllCommands(subcmds, subcmdCount);
+// The levels of the tree above the current command are kept in listStack,
+// the index of a level is the command whose subcommands are listed below it.
+// A listing of a subcommand table starts with the path to the table on the stack,
+// so every line prints its parent commands from the stack instead of searching the tree.
+void SerialCommands::startListing(const Command* commands, uint16_t commandsCount, bool all) {
+  if (!listStack.isAllocated()) {
+    listStack.allocate(countLevels(this->commands, this->commandsCount));
+  }
+  listAll = all;
+  listBase = listDepth = 0;
+  if (listStack.getSize() == 0)
+    return;
+
+  if (!findTable(commands)) {
+    // a table outside of the tree is listed without parents
+    listStack[0] = ListLevel{ commands, commandsCount, 0 };
+    listDepth = 1;
+  }
+  listBase = listDepth - 1;
+  listStack[listBase].count = commandsCount;
+  continueListing();
+}
+
+// depth-first search for the table, leaves the path to it on the stack
+bool SerialCommands::findTable(const Command* table) {
+  listStack[0] = ListLevel{ commands, commandsCount, 0 };
+  listDepth = 1;
+  while (listDepth > 0) {
+    ListLevel& level = listStack[listDepth - 1];
+    if (level.commands == table)
+      return true;
+    if (level.index == level.count) {
+      if (--listDepth > 0) listStack[listDepth - 1].index++;
+      continue;
     }
+    if (!enterSubcommands(getCommand(level.commands, level.index)))
+      level.index++;
+  }
+  return false;
+}
+
+bool SerialCommands::enterSubcommands(const Command& command) {
+  const Command* subcmds = nullptr;
+  uint16_t subcmdCount = 0;
+  command.getSubCommands(&subcmds, &subcmdCount);
+  if (subcmds == nullptr || listDepth == listStack.getSize())
+    return false;
+  listStack[listDepth++] = ListLevel{ subcmds, subcmdCount, 0 };
+  return true;
+}
+
+void SerialCommands::continueListing() {
+  for (uint16_t lines = 0; (listLines == 0 || lines < listLines) && listDepth > listBase; ++lines) {
+    listNext();
   }
 }
 
-void SerialCommands::readSerial() {
-  static uint16_t index = 0;
-  static uint64_t lastTime = millis();
+// prints the next line of the listing, the listing ends when the stack is back at its base
+void SerialCommands::listNext() {
+  while (listDepth > listBase) {
+    ListLevel& level = listStack[listDepth - 1];
+    if (level.index < level.count) {
+      Command cmd = getCommand(level.commands, level.index);
+      for (uint8_t i = 0; i < listDepth - 1; ++i) {
+        printCommandSyntax(getCommand(listStack[i].commands, listStack[i].index));
+        serial.print(' ');
+      }
+      printCommandSyntax(cmd);
+      serial.print(F(" - "));
+      printCommandDescription(cmd);
+      serial.println();
+
+      if (!listAll || !enterSubcommands(cmd))
+        level.index++;
+      return;
+    }
+    if (--listDepth > listBase) listStack[listDepth - 1].index++;
+  }
+}
 
-  if (timeout != 0 && lastTime + timeout < millis()) {
+uint8_t SerialCommands::countLevels(const Command* commands, uint16_t commandsCount) {
+  uint8_t maximum = 0;
+  for (uint16_t i = 0; i < commandsCount; ++i) {
+    const Command* subcommands = nullptr;
+    uint16_t subcommandsCount = 0;
+    getCommand(commands, i).getSubCommands(&subcommands, &subcommandsCount);
+    uint8_t count = subcommands ? countLevels(subcommands, subcommandsCount) : 0;
+    if (count > maximum) maximum = count;
+  }
+  return commandsCount > 0 ? maximum + 1 : 0;
+}
+
+void SerialCommands::readSerial(uint16_t maxBytes) {
+  if (buffer == nullptr) {
+    lineBuffer.allocate(bufferSize);
+    if (!lineBuffer.isAllocated())
+      return;
+    buffer = lineBuffer.get(0);
+  }
+  if (!argsReserved) {
+    reserveArgs();
+  }
+#if CMD_STATS
+  if (!commandStats.isAllocated()) {
+    reserveStats();
+  }
+#endif
+
+  // a line that overflowed and never got its terminator is dropped by the timeout as well
+  if (timeout != 0 && (index > 0 || discard) && millis() - lastTime > timeout) {
     index = 0;
+    discard = false;
+    unparsed = false;
+    resetParser();
+  }
+
+  if (output) {
+    output->poll();
   }
 
-  while (serial.available() > 0) {
+  // commands run from poll when the queue is enabled, their listings continue there
+  if (queue == nullptr) {
+    continueListing();
+  }
+
+  if (flowControl) {
+    updateFlow();
+  }
+
+  int available;
+  while (maxBytes > 0 && ((available = ring ? ring->available() : serial.available()) > 0 || unparsed)) {
+    // the next line might not fit into the queue, it waits in the stream
+    if (isQueueBlocked()) {
+      lastTime = millis();
+      break;
+    }
+    // read as much as fits, the terminator is replaced by a null
+    uint16_t count = bufferSize - index;
+    if ((unsigned int) available < count) count = available;
+    if (count > maxBytes) count = maxBytes;
+    if (count > 0) {
+      count = ring ? ring->read(buffer + index, count) : serial.readBytes(buffer + index, count);
+    }
+    if (count == 0 && !unparsed) break;
+    maxBytes -= count;
     lastTime = millis();
-    int ch = serial.read();
-    if (isTerm(ch)) {
-      if (index > 0) {
-        buffer[index] = '\0';
-        parseCommand(buffer);
-        index = 0;
-      }
-    } else if (index < bufferSize) {
-      buffer[index] = ch;
-      index++;
-    } else {
-      serial.println(F("ERROR: Buffer overflow"));
+#if CMD_STATS
+    if (index + count > stats.bufferHighWater) {
+      stats.bufferHighWater = index + count;
+    }
+#endif
+
+    char* begin = buffer;
+    char* next = unparsed ? buffer : buffer + index;
+    char* const end = buffer + index + count;
+    unparsed = false;
+    for (;;) {
+      if (framesEnabled && !discard && begin < end && (uint8_t) *begin == frameSync) {
+        if (end - begin < 2)
+          break;
+        uint16_t frameSize = (uint8_t) begin[1] + CMD_FRAME_OVERHEAD;
+        if (frameSize > bufferSize) {
+          writeFrame(FrameStatus::FrameTooLong, nullptr, 0);
+          begin = end;
+          discard = true;
+          break;
+        }
+        if (end - begin < frameSize)
+          break;
+        parseFrame((uint8_t*) begin);
+        if (output) {
+          output->endCommand();
+        }
+        begin += frameSize;
+        next = begin;
+        if (isQueueBlocked()) {
+          unparsed = begin < end;
+          break;
+        }
+        continue;
+      }
+
+      if ((next += scanTerm(next, end - next, isTerm)) >= end) {
+        // parse what arrived so far, the terminator only dispatches
+        if (!discard) {
+          feedParser(begin, end - begin);
+        }
+        break;
+      }
+      *next = '\0';
+      if (discard) {
+        discard = false;
+      } else {
+        feedParser(begin, next - begin);
+        finishLine(begin, next - begin);
+        if (output) {
+          output->endCommand();
+        }
+        // the stream fills up while the commands of the line run
+        if (flowControl) {
+          updateFlow();
+        }
+      }
+      begin = ++next;
+      // the rest of the buffer is parsed when the queue has room again
+      if (isQueueBlocked()) {
+        unparsed = begin < end;
+        break;
+      }
+    }
+
+    // keep the unterminated part of the line at the start of the buffer
+    index = discard ? 0 : end - begin;
+    if (begin != buffer) {
+      memmove(buffer, begin, index);
+      moveSlices(begin - buffer);
+    }
+
+    if (index == bufferSize) {
+      if (errorFormat == ErrorFormat::Text) {
+        serial.println(F("ERROR: Buffer overflow"));
+      } else {
+        printError(FrameStatus::BufferOverflow);
+      }
+#if CMD_STATS
+      stats.overflows++;
+#endif
       index = 0;
+      discard = true;
+      resetParser();
+    }
+  }
+
+  if (flowControl) {
+    updateFlow();
+  }
+}
+
+uint8_t SerialCommands::getFillLevel() {
+  uint16_t waiting = ring ? 0 : serial.available();
+  uint32_t level = (uint32_t) (index + waiting) * 100 / bufferSize;
+  if (ring) {
+    uint32_t ringLevel = (uint32_t) ring->available() * 100 / ring->getSize();
+    if (ringLevel > level) level = ringLevel;
+  }
+  if (queue) {
+    const uint16_t head = impl::loadIndex(&queueHead);
+    const uint16_t used = queueTail >= head ? queueTail - head : queueSize - head + queueTail;
+    uint32_t queueLevel = (uint32_t) used * 100 / queueSize;
+    if (queueLevel > level) level = queueLevel;
+  }
+  return level > 100 ? 100 : level;
+}
+
+void SerialCommands::updateFlow() {
+  uint8_t level = getFillLevel();
+  if (!throttled && level >= flowHigh) {
+    setThrottled(true);
+  } else if (throttled && level <= flowLow) {
+    setThrottled(false);
+  }
+}
+
+void SerialCommands::setThrottled(bool throttle) {
+  throttled = throttle;
+  if (flowCallback) {
+    flowCallback(throttle);
+    return;
+  }
+  // XON and XOFF bypass buffered output, they must not wait behind it or be dropped when it is full
+  Stream& port = output ? output->getStream() : serial;
+  port.write(throttle ? CMD_XOFF : CMD_XON);
+}
+
+void SerialCommandsGroup::readSerial() {
+  // every port gets the same byte budget, the port served first rotates
+  for (uint8_t i = 0; i < portsCount; ++i) {
+    ports[(first + i) % portsCount].readSerial(budget);
+  }
+  first = (first + 1) % portsCount;
+}
+
+void SerialCommands::sortCommands() {
+  // tables in program memory are indexed at compile time, see PGM_COMMAND_TABLE
+  if (indexed)
+    return;
+  nameIndex.allocate(countCommands(commands, commandsCount));
+  if (nameIndex.getSize() == 0)
+    return;
+  uint16_t next = 0;
+  indexTable(commands, commandsCount, next);
+  indexed = true;
+}
+
+// The tables keep their order, the index of each one lists its commands in the order
+// of their names, so command indices and listings don't change. Returns the start of the index.
+uint16_t SerialCommands::indexTable(const Command* commands, uint16_t commandsCount, uint16_t& next) {
+  uint16_t base = next;
+  next += commandsCount;
+  for (uint16_t i = 0; i < commandsCount; ++i) {
+    PGM_P name = commands[i].getCommandPgm();
+    uint16_t j = i;
+    for (; j > 0 && comparePgm(commands[nameIndex[base + j - 1].entry].getCommandPgm(), name) > 0; --j) {
+      nameIndex[base + j] = nameIndex[base + j - 1];
     }
+    nameIndex[base + j].entry = i;
+  }
+
+  for (uint16_t i = 0; i < commandsCount; ++i) {
+    const Command* subcmds = nullptr;
+    uint16_t subcmdCount = 0;
+    commands[i].getSubCommands(&subcmds, &subcmdCount);
+    nameIndex[base + i].subcommands = indexTable(subcmds, subcmdCount, next);
+  }
+  return base;
+}
+
+uint16_t SerialCommands::countCommands(const Command* commands, uint16_t commandsCount) {
+  uint16_t count = commandsCount;
+  for (uint16_t i = 0; i < commandsCount; ++i) {
+    const Command* subcommands;
+    uint16_t subcommandsCount;
+    getCommand(commands, i).getSubCommands(&subcommands, &subcommandsCount);
+    count += countCommands(subcommands, subcommandsCount);
+  }
+  return count;
+}
+
+int SerialCommands::comparePgm(PGM_P a, PGM_P b) {
+  uint8_t ca, cb;
+  do {
+    ca = pgm_read_byte(a++);
+    cb = pgm_read_byte(b++);
+  } while (ca == cb && ca != '\0');
+  return (int) ca - (int) cb;
+}
+
+// 0 if the name starts with the token, a token with a null character sorts after every name
+int SerialCommands::compareToken(const char* token, uint16_t len, PGM_P name) {
+  for (uint16_t i = 0; i < len; ++i) {
+    uint8_t c = pgm_read_byte(name + i);
+    if ((uint8_t) token[i] != c || c == '\0')
+      return c == '\0' ? 1 : (int) (uint8_t) token[i] - (int) c;
   }
+  return 0;
 }
 
-const Command* SerialCommands::findCommand(const char* const string, const Command* commands, uint16_t commandsCount) {
-  uint16_t len = strlen(string);
-  uint16_t index;
+Command SerialCommands::findCommand(const char* const string, uint16_t len, const Command* commands, uint16_t commandsCount, uint16_t& position) {
+  Command match;
   uint16_t count = 0;
   for (uint16_t i = 0; i < commandsCount; ++i) {
-    PGM_P cmd = commands[i].getCommandPgm();
-    if (memcmp_P(string, cmd, len + 1) == 0)
-      return &commands[i];
-    if (memcmp_P(string, cmd, len) == 0) {
+    Command cmd = getCommand(commands, i);
+    PGM_P name = cmd.getCommandPgm();
+    if (memcmp_P(string, name, len) == 0) {
+      if (pgm_read_byte(name + len) == '\0') {
+        position = i;
+        return cmd;
+      }
       ++count;
-      index = i;
+      match = cmd;
+      position = i;
     }
   }
   if (count == 1)
-    return &commands[index];
+    return match;
+  return Command();
+}
+
+// the position in parser.cmds of the command with the rank
+uint16_t SerialCommands::indexedEntry(uint16_t rank) {
+  return nameIndex[parser.indexBase + rank].entry;
+}
+
+// the trie of a table in program memory follows its entries, see PGM_COMMAND_TABLE
+static const impl::TrieNode* trieOf(const Command* commands, uint16_t count) {
+  return reinterpret_cast<const impl::TrieNode*>(commands + count);
+}
+
+static const uint16_t TrieDead = 0xFFFF;
+
+// the token is a command name of a table in program memory, see endToken
+bool SerialCommands::trieToken() {
+  return pgmCommands && parser.argPos >= parser.argCount && parser.cmds != nullptr;
+}
+
+void SerialCommands::startCommand() {
+  parser.node = 0;
+  parser.matched = 0;
+  parser.nodeName = getCommand(parser.cmds, pgm_read_word(&trieOf(parser.cmds, parser.cmdsCount)->entry)).getCommandPgm();
+}
+
+// Follows the characters of a command name down the trie, within a node they are compared
+// with the name of its entry, at its end with the first characters of its children.
+void SerialCommands::narrowCommand(const char* chars, uint16_t count) {
+  const impl::TrieNode* trie = trieOf(parser.cmds, parser.cmdsCount);
+  for (uint16_t i = 0; i < count && parser.node != TrieDead; ++i) {
+    uint8_t length = pgm_read_byte(&trie[parser.node].length);
+    if (parser.matched < (length & ~impl::TrieLeaf)) {
+      if (chars[i] != (char) pgm_read_byte(parser.nodeName + parser.matched))
+        parser.node = TrieDead;
+    } else if (length & impl::TrieLeaf) {
+      parser.node = TrieDead;
+    } else {
+      uint16_t child = parser.node + 1;
+      while (child != 0 && chars[i] != (char) pgm_read_byte(&trie[child].c))
+        child = pgm_read_word(&trie[child].next);
+      parser.node = child != 0 ? child : TrieDead;
+      if (child != 0)
+        parser.nodeName = getCommand(parser.cmds, pgm_read_word(&trie[child].entry)).getCommandPgm();
+    }
+    parser.matched++;
+  }
+}
+
+// the name is the prefix of the node or the only name that starts with the characters
+Command SerialCommands::trieCommand(uint16_t& position) {
+  if (parser.node == TrieDead)
+    return Command();
+  const impl::TrieNode* node = trieOf(parser.cmds, parser.cmdsCount) + parser.node;
+  uint8_t length = pgm_read_byte(&node->length);
+  if (!(length & impl::TrieLeaf) && (parser.matched != length || pgm_read_byte(parser.nodeName + length) != '\0'))
+    return Command();
+  position = pgm_read_word(&node->entry);
+  return getCommand(parser.cmds, position);
+}
+
+// binary search for the first name that the token doesn't sort after, the names that start
+// with the token follow it, the shortest one first, so the next name tells if it is unique
+Command SerialCommands::searchCommand(const char* token, uint16_t len, uint16_t& position) {
+  uint16_t lo = 0;
+  uint16_t hi = parser.cmdsCount;
+  while (lo < hi) {
+    uint16_t mid = lo + (hi - lo) / 2;
+    if (compareToken(token, len, getCommand(parser.cmds, indexedEntry(mid)).getCommandPgm()) > 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == parser.cmdsCount)
+    return Command();
+  position = indexedEntry(lo);
+  Command cmd = getCommand(parser.cmds, position);
+  PGM_P name = cmd.getCommandPgm();
+  if (compareToken(token, len, name) != 0)
+    return Command();
+  if (pgm_read_byte(name + len) == '\0' || lo + 1 == parser.cmdsCount
+      || compareToken(token, len, getCommand(parser.cmds, indexedEntry(lo + 1)).getCommandPgm()) != 0)
+    return cmd;
+  return Command();
+}
+
+// A line holds the arguments of the longest path of the command tree,
+// or of a batch that fits into the buffer. The static array of CMD_PGM_ARGS holds
+// the longest path, only a batch replaces it by a larger one on the heap.
+// The array never shrinks, so changing the separator doesn't free and allocate it again.
+void SerialCommands::reserveArgs() {
+  argsReserved = true;
+  uint16_t count = staticArgs > 0 ? staticArgs : countArgs(commands, commandsCount);
+  if (isSeparator) {
+    // every argument takes at least two characters with its delimiter
+    uint16_t batchCount = count * CMD_MAX_BATCH;
+    if (batchCount > bufferSize / 2) batchCount = bufferSize / 2;
+    if (batchCount > count) count = batchCount;
+  }
+  // arguments are indexed with uint8_t
+  if (count > UINT8_MAX) count = UINT8_MAX;
+  if (!args.isAllocated() || count > args.getSize()) {
+    args.allocate(count);
+  }
+  if (!strings.isAllocated() && hasStringArgs(commands, commandsCount)) {
+    // strings can't take more than the line
+    strings.allocate(bufferSize < CMD_STRINGS_SIZE ? bufferSize : CMD_STRINGS_SIZE);
+  }
+}
+
+bool SerialCommands::hasStringArgs(const Command* commands, uint16_t commandsCount) {
+  for (uint16_t i = 0; i < commandsCount; ++i) {
+    Command cmd = getCommand(commands, i);
+    uint8_t argCount;
+    const impl::ArgConstraint* argcs = cmd.getArgsPgm(&argCount);
+    for (uint8_t j = 0; j < argCount; ++j) {
+      if (argcs[j].getType() == ArgType::String)
+        return true;
+    }
+    const Command* subcommands;
+    uint16_t subcommandsCount;
+    cmd.getSubCommands(&subcommands, &subcommandsCount);
+    if (hasStringArgs(subcommands, subcommandsCount))
+      return true;
+  }
+  return false;
+}
+
+uint16_t SerialCommands::countArgs(const Command* commands, uint16_t commandsCount) {
+  uint16_t maximum = 0;
+  for (uint16_t i = 0; i < commandsCount; ++i) {
+    Command cmd = getCommand(commands, i);
+    uint8_t argCount;
+    const impl::ArgConstraint* argcs = cmd.getArgsPgm(&argCount);
+    const Command* subcommands;
+    uint16_t subcommandsCount;
+    cmd.getSubCommands(&subcommands, &subcommandsCount);
+    uint16_t count = countArgs(subcommands, subcommandsCount);
+    for (uint8_t j = 0; j < argCount; ++j) {
+      count += argcs[j].getMaxCount();
+    }
+    if (count > maximum) maximum = count;
+  }
+  return maximum;
+}
+
+#if CMD_STATS
+// the counters of every command of the tree, sorted by command address
+void SerialCommands::reserveStats() {
+  commandStats.allocate(countCommands(commands, commandsCount));
+  uint16_t count = 0;
+  collectCommands(commands, commandsCount, count);
+
+  for (uint16_t i = 1; i < count; ++i) {
+    impl::CommandStatsEntry entry = commandStats[i];
+    uint16_t j = i;
+    for (; j > 0 && (uintptr_t) commandStats[j - 1].command > (uintptr_t) entry.command; --j) {
+      commandStats[j] = commandStats[j - 1];
+    }
+    commandStats[j] = entry;
+  }
+}
+
+void SerialCommands::collectCommands(const Command* commands, uint16_t commandsCount, uint16_t& index) {
+  for (uint16_t i = 0; i < commandsCount && index < commandStats.getSize(); ++i) {
+    Command cmd = getCommand(commands, i);
+    commandStats[index++].command = cmd.get();
+    const Command* subcommands;
+    uint16_t subcommandsCount;
+    cmd.getSubCommands(&subcommands, &subcommandsCount);
+    collectCommands(subcommands, subcommandsCount, index);
+  }
+}
+
+CommandStats* SerialCommands::findStats(const Command& command) {
+  uint16_t lo = 0;
+  uint16_t hi = commandStats.getSize();
+  while (lo < hi) {
+    uint16_t mid = lo + (hi - lo) / 2;
+    impl::CommandStatsEntry& entry = commandStats[mid];
+    if (entry.command == command.get())
+      return &entry.stats;
+    if ((uintptr_t) entry.command < (uintptr_t) command.get()) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
   return nullptr;
 }
 
-void SerialCommands::parseCommand(char* string) {
-  char* token;
-  uint16_t i;
-  uint8_t argCount;
-  uint16_t argIndex = 0;
-  Args args{};
-  const Command* cmd = nullptr;
-  const Command* cmds = this->commands;
-  uint16_t cmdsCount = commandsCount;
+void SerialCommands::resetStats() {
+  stats = SerialStats();
+  for (uint16_t i = 0; i < commandStats.getSize(); ++i) {
+    commandStats[i].stats = CommandStats();
+  }
+}
+
+void SerialCommands::printStats() {
+  serial.print(F("lines "));
+  serial.print(stats.lines);
+  serial.print(F(", unknown commands "));
+  serial.print(stats.unknownCommands);
+  serial.print(F(", argument count errors "));
+  serial.print(stats.argumentCountErrors);
+  serial.print(F(", overflows "));
+  serial.print(stats.overflows);
+  serial.print(F(", buffer "));
+  serial.print(stats.bufferHighWater);
+  serial.print('/');
+  serial.println(bufferSize);
+
+  printStats(commands, commandsCount);
+
+  serial.print(F("parse us:"));
+  printHistogram(stats.parseTime);
+  serial.print(F("run us:"));
+  printHistogram(stats.runTime);
+}
+
+// commands that were never called and had no errors are skipped
+void SerialCommands::printStats(const Command* commands, uint16_t commandsCount) {
+  for (uint16_t i = 0; i < commandsCount; ++i) {
+    Command cmd = getCommand(commands, i);
+    const CommandStats* commandStats = findStats(cmd);
+    if (commandStats && (commandStats->calls || commandStats->parseErrors || commandStats->rangeErrors)) {
+      printCommand(cmd);
+      serial.print(F(": calls "));
+      serial.print(commandStats->calls);
+      serial.print(F(", parse errors "));
+      serial.print(commandStats->parseErrors);
+      serial.print(F(", range errors "));
+      serial.print(commandStats->rangeErrors);
+      serial.print(F(", run "));
+      serial.print(commandStats->runMicros);
+      serial.println(F(" us"));
+    }
 
-  token = getToken(&string);
-  while (token != nullptr) {
-    cmd = findCommand(token, cmds, cmdsCount);
-    if (cmd != nullptr) {
-      const impl::ArgConstraint* argcs = cmd->getArgsPgm(&argCount);
-      impl::ArgConstraint argc;
-      for (i = 0; i < argCount; ++i) {
-        memcpy_P(&argc, &argcs[i], sizeof(impl::ArgConstraint));
-        if ((token = getToken(&string)) != nullptr) {
-          if (!getArg(args[argIndex], token, argc)) {
-            serial.print(F("ERROR: Can't parse argument "));
-            serial.println(argIndex + 1);
-            printCommand(*cmd);
-            serial.println();
-            return;
-          }
-          
-          if (!argc.isInRange(args[argIndex])) {
-            serial.print(F("ERROR: Argument out of range "));
-            serial.print(argIndex + 1);
-            impl::Range range = argc.getRange();
-            serial.print(F(" ("));
-            serial.print(range.minimum);
-            serial.print(F(" - "));
-            serial.print(range.maximum);
-            serial.println(')');
-            printCommand(*cmd);
-            serial.println();
-            return;
-          }
-          argIndex++;
+    const Command* subcommands;
+    uint16_t subcommandsCount;
+    cmd.getSubCommands(&subcommands, &subcommandsCount);
+    printStats(subcommands, subcommandsCount);
+  }
+}
+
+void SerialCommands::printHistogram(const TimeHistogram& histogram) {
+  for (uint8_t i = 0; i < CMD_STATS_BUCKETS; ++i) {
+    if (histogram.counts[i] == 0)
+      continue;
+    serial.print(' ');
+    if (i < CMD_STATS_BUCKETS - 1) {
+      serial.print('<');
+      serial.print(1UL << (i + 1));
+    } else {
+      serial.print(F(">="));
+      serial.print(1UL << i);
+    }
+    serial.print(':');
+    serial.print(histogram.counts[i]);
+  }
+  serial.println();
+}
+#endif
+
+void SerialCommands::resetParser() {
+  parser = LineParser();
+  parser.cmds = commands;
+  parser.cmdsCount = commandsCount;
+}
+
+void SerialCommands::feedParser(const char* line, uint16_t length) {
+  typedef LineParser::Token Token;
+  uint16_t pos = parser.scanned;
+  parser.scanned = length;
+#if CMD_STATS
+  unsigned long start = micros();
+#endif
+
+  while (pos < length && parser.error == LineParser::Error::None) {
+    switch (parser.token) {
+      case Token::None:
+        while (pos < length && isDelim(line[pos])) pos++;
+        if (pos == length)
+          break;
+        if (isSeparator && isSeparator(line[pos])) {
+          closeCommand(line, pos++);
+          break;
+        }
+        if (isQuotation(line[pos])) {
+          parser.token = Token::Quoted;
+          parser.quote = line[pos++];
         } else {
-          serial.println(F("ERROR: Not enough arguments"));
-          printCommand(*cmd);
-          serial.println();
-          return;
+          parser.token = Token::Unquoted;
         }
+        parser.tokenBegin = pos;
+        if (trieToken())
+          startCommand();
+        break;
+      case Token::Unquoted: {
+        uint16_t begin = pos;
+        while (pos < length && !isDelim(line[pos]) && !(isSeparator && isSeparator(line[pos]))) pos++;
+        if (trieToken())
+          narrowCommand(line + begin, pos - begin);
+        if (pos < length) {
+          // a separator is handled as the start of the next token
+          parser.token = Token::None;
+          endToken(line, isDelim(line[pos]) ? pos++ : pos);
+        }
+        break;
       }
-      cmd->getSubCommands(&cmds, &cmdsCount);
-
-      if (cmds == nullptr) {
-        if ((token = getToken(&string)) != nullptr) {
-          serial.println(F("ERROR: Too many arguments"));
-          printCommand(*cmd);
-          serial.println();
-          return;
+      case Token::Quoted: {
+        uint16_t begin = pos;
+        while (pos < length && line[pos] != parser.quote) pos++;
+        if (trieToken())
+          narrowCommand(line + begin, pos - begin);
+        if (pos < length) {
+          parser.token = Token::None;
+          endToken(line, pos++);
         }
-        cmd->runCommand(*this, args);
+        break;
       }
+    }
+  }
+#if CMD_STATS
+  parser.parseMicros += micros() - start;
+#endif
+}
+
+void SerialCommands::endToken(const char* line, uint16_t end) {
+  const char* token = line + parser.tokenBegin;
+  uint16_t tokenLength = end - parser.tokenBegin;
+  parser.tokenEnd = end;
+
+  if (parser.argPos < parser.argCount) {
+    if (parser.argIndex == args.getSize()) {
+      parser.error = LineParser::Error::TooManyArguments;
+      return;
+    }
+    Arg& arg = args[parser.argIndex];
+#if CMD_LAZY_ARGS
+    arg = Arg(token, tokenLength, &parser.argcs[parser.argPos]);
+#else
+    const impl::ArgConstraint& argc = parser.argcs[parser.argPos];
+    if (!getArg(arg, token, tokenLength, argc.getType())) {
+      parser.error = LineParser::Error::ParseError;
+      return;
+    }
+    if (!argc.isInRange(arg)) {
+      parser.error = LineParser::Error::RangeError;
+      return;
+    }
+#endif
+    parser.argIndex++;
+    // arrays and variadic arguments take several tokens
+    if (++parser.repeat >= parser.argcs[parser.argPos].getMaxCount()) {
+      parser.argPos++;
+      parser.repeat = 0;
+    }
+    return;
+  }
 
-      token = getToken(&string);
+  if (parser.cmds == nullptr) {
+    parser.error = LineParser::Error::TooManyArguments;
+    return;
+  }
+
+  // the trie of a table in program memory was walked as the name arrived,
+  // small tables in RAM are faster to scan than to search
+  uint16_t position = 0;
+  Command cmd;
+  if (pgmCommands) {
+    cmd = trieCommand(position);
+  } else {
+    cmd = indexed && parser.cmdsCount > CMD_SCAN_COMMANDS ? searchCommand(token, tokenLength, position)
+          : findCommand(token, tokenLength, parser.cmds, parser.cmdsCount, position);
+  }
+  if (!cmd) {
+    parser.error = LineParser::Error::UnknownCommand;
+    return;
+  }
+  if (indexed && !pgmCommands) {
+    parser.indexBase = nameIndex[parser.indexBase + position].subcommands;
+  }
+  parser.cmd = cmd;
+  parser.argcs = cmd.getArgsPgm(&parser.argCount);
+  parser.argPos = 0;
+  parser.repeat = 0;
+  cmd.getSubCommands(&parser.cmds, &parser.cmdsCount);
+}
 
-      if (token == nullptr && cmds != nullptr) {
-        cmd->runCommand(*this, args);
+// the command is complete at a separator or at the end of the line
+void SerialCommands::closeCommand(const char* line, uint16_t end) {
+  if (parser.token != LineParser::Token::None) {
+    parser.token = LineParser::Token::None;
+    endToken(line, end);
+  }
+  if (parser.error != LineParser::Error::None || !parser.cmd)
+    return;
+  // a variadic argument can end the command
+  if (parser.argPos < parser.argCount &&
+      (parser.argPos + 1 < parser.argCount || parser.repeat < parser.argcs[parser.argPos].getMinCount())) {
+    parser.error = LineParser::Error::NotEnoughArguments;
+    return;
+  }
+  if (parser.batchCount == CMD_MAX_BATCH) {
+    parser.error = LineParser::Error::TooManyCommands;
+    return;
+  }
+  parser.batch[parser.batchCount] = parser.cmd;
+  parser.batchFirst[parser.batchCount] = parser.argFirst;
+  parser.batchCount++;
+
+  // the next command starts at the top level
+  parser.cmd = Command();
+  parser.cmds = commands;
+  parser.cmdsCount = commandsCount;
+  parser.indexBase = 0;
+  parser.argCount = 0;
+  parser.argPos = 0;
+  parser.repeat = 0;
+  parser.argFirst = parser.argIndex;
+}
+
+void SerialCommands::finishLine(const char* line, uint16_t length) {
+  this->line = line;
+  lineLength = length;
+
+  closeCommand(line, length);
+
+#if CMD_STATS
+  stats.lines++;
+  stats.parseTime.add(parser.parseMicros);
+  if (parser.error == LineParser::Error::UnknownCommand) {
+    stats.unknownCommands++;
+  } else if (parser.error == LineParser::Error::NotEnoughArguments || parser.error == LineParser::Error::TooManyArguments) {
+    stats.argumentCountErrors++;
+  }
+#endif
+
+  uint16_t argNumber = parser.argIndex - parser.argFirst + 1;
+  if (errorFormat != ErrorFormat::Text) {
+    switch (parser.error) {
+      case LineParser::Error::UnknownCommand:
+        printError(FrameStatus::UnknownCommand);
+        resetParser();
         return;
-      }
+      case LineParser::Error::NotEnoughArguments:
+        printError(FrameStatus::NotEnoughArguments, parser.cmd);
+        resetParser();
+        return;
+      case LineParser::Error::TooManyArguments:
+        printError(FrameStatus::TooManyArguments, parser.cmd);
+        resetParser();
+        return;
+      case LineParser::Error::TooManyCommands:
+        printError(FrameStatus::TooManyCommands);
+        resetParser();
+        return;
+      default:
+        break;
+    }
+  }
 
-    } else {
+  switch (parser.error) {
+    case LineParser::Error::None:
+      runBatch();
+      break;
+    case LineParser::Error::UnknownCommand:
       serial.print(F("ERROR: Command does not exist \""));
-      serial.print(token);
+      serial.write(line + parser.tokenBegin, parser.tokenEnd - parser.tokenBegin);
       serial.println('"');
+      break;
+    case LineParser::Error::ParseError:
+      printParseError(argNumber, parser.cmd);
+      break;
+    case LineParser::Error::RangeError:
+      printRangeError(argNumber, parser.argcs[parser.argPos], parser.cmd);
+      break;
+    case LineParser::Error::NotEnoughArguments:
+      serial.println(F("ERROR: Not enough arguments"));
+      printCommand(parser.cmd);
+      serial.println();
+      break;
+    case LineParser::Error::TooManyArguments:
+      serial.println(F("ERROR: Too many arguments"));
+      printCommand(parser.cmd);
+      serial.println();
+      break;
+    case LineParser::Error::TooManyCommands:
+      serial.println(F("ERROR: Too many commands"));
+      break;
+  }
+
+  resetParser();
+}
+
+// every command of the line was validated before the first one runs
+void SerialCommands::runBatch() {
+  const uint8_t count = parser.batchCount;
+  if (count == 0)
+    return;
+
+#if CMD_LAZY_ARGS
+  // queued arguments are converted here, the line is gone when they are read
+  if (count > 1 || queue) {
+    for (uint8_t j = 0; j < count; ++j) {
+      uint16_t first = parser.batchFirst[j];
+      uint16_t last = j + 1 < count ? parser.batchFirst[j + 1] : parser.argIndex;
+      for (uint16_t i = first; i < last; ++i) {
+        args[i].convert();
+      }
+      if (printArgError(parser.batch[j], args.get(first), last - first))
+        return;
+    }
+  }
+#endif
+  if (queue) {
+    // a batch is queued as a whole or not at all, poll sees the records when the tail is stored
+    uint16_t tail = queueTail;
+    for (uint8_t j = 0; j < count; ++j) {
+      uint16_t first = parser.batchFirst[j];
+      uint16_t last = j + 1 < count ? parser.batchFirst[j + 1] : parser.argIndex;
+      uint8_t flags = j + 1 == count && batchStatus ? impl::QueuedCommand::BatchEnd : 0;
+      if (!enqueue(parser.batch[j], args.get(first), last - first, flags, tail)) {
+        if (errorFormat == ErrorFormat::Text) {
+          serial.println(F("ERROR: Queue full"));
+        } else {
+          printError(FrameStatus::QueueFull);
+        }
+        return;
+      }
+    }
+    impl::storeIndex(&queueTail, tail);
+    return;
+  }
+
+  copyStrings();
+
+  // every command sees its own arguments from index 0
+  for (uint8_t j = 0; j < count; ++j) {
+    uint16_t first = parser.batchFirst[j];
+    uint16_t last = j + 1 < count ? parser.batchFirst[j + 1] : parser.argIndex;
+    Args commandArgs(args.get(first), last - first);
+    if (!runCommand(parser.batch[j], commandArgs))
       return;
+  }
+
+  if (batchStatus) {
+    serial.println(F("OK"));
+  }
+}
+
+void SerialCommands::enableQueue(uint8_t* buffer, uint16_t size) {
+  // records start at an address aligned for QueuedCommand and end before the end of the buffer
+  const uint16_t align = alignof(impl::QueuedCommand);
+  uint16_t padding = (align - (uintptr_t) buffer % align) % align;
+  if (size < padding) size = padding;
+  queue = buffer + padding;
+  queueSize = (size - padding) / align * align;
+  queueHead = queueTail = 0;
+  step = 0;
+}
+
+bool SerialCommands::poll() {
+  if (output) {
+    output->poll();
+  }
+
+  if (queue != nullptr) {
+    continueListing();
+  }
+
+  uint16_t head = queueHead;
+  if (head == impl::loadIndex(&queueTail))
+    return false;
+
+  impl::QueuedCommand* record = (impl::QueuedCommand*) (queue + head);
+  if (queueSize - head < (uint16_t) sizeof(impl::QueuedCommand) || (record->flags & impl::QueuedCommand::Skip)) {
+    head = 0;
+    record = (impl::QueuedCommand*) queue;
+  }
+  Args commandArgs(record->getArgs(), record->argCount);
+  again = false;
+  runCommand(record->command, commandArgs);
+  if (again) {
+    step++;
+    return true;
+  }
+
+  step = 0;
+  if (record->flags & impl::QueuedCommand::Frame) {
+    writeFrame(FrameStatus::Ok, nullptr, 0);
+  }
+  if (record->flags & impl::QueuedCommand::BatchEnd) {
+    serial.println(F("OK"));
+  }
+  head += record->size;
+  // the room of the record can be reused from here on
+  impl::storeIndex(&queueHead, head == queueSize ? 0 : head);
+  if (output) {
+    output->endCommand();
+  }
+  return true;
+}
+
+// string arguments are copied with their terminating null
+uint16_t SerialCommands::recordSize(Arg* args, uint8_t argCount) {
+  uint16_t size = sizeof(impl::QueuedCommand) + argCount * sizeof(Arg);
+  for (uint8_t i = 0; i < argCount; ++i) {
+    if (args[i].type == ArgType::String) {
+      size += args[i].value.string.length + 1;
     }
   }
+  const uint16_t align = alignof(impl::QueuedCommand);
+  return (size + align - 1) / align * align;
+}
+
+bool SerialCommands::isQueueBlocked() {
+  return flowControl && queue && !isQueueEmpty() && !hasQueueRoom(lineRecordsSize());
 }
 
-char* SerialCommands::getToken(char** stringp) {
-  char *begin, *end;
-  begin = *stringp;
-  if (begin == nullptr)
+// most queue bytes taken by the records of one line or frame
+uint16_t SerialCommands::lineRecordsSize() {
+  const uint16_t records = isSeparator ? CMD_MAX_BATCH : 1;
+  return records * (sizeof(impl::QueuedCommand) + alignof(impl::QueuedCommand) - 1)
+         + args.getSize() * (sizeof(Arg) + 1) + bufferSize;
+}
+
+// true if placeRecord finds room for size bytes, the records of a line
+// that take size bytes together fit as well
+bool SerialCommands::hasQueueRoom(uint16_t size) {
+  const uint16_t head = impl::loadIndex(&queueHead);
+  const uint16_t pos = queueTail;
+  if (pos < head)
+    return head - pos > size;
+  return queueSize - pos > size || head > size;
+}
+
+// Room for size bytes at tail, or at the start of the buffer if they don't fit before its end.
+// The tail never catches up with the head, equal offsets mean the queue is empty.
+uint8_t* SerialCommands::placeRecord(uint16_t size, uint16_t& tail) {
+  const uint16_t head = impl::loadIndex(&queueHead);
+  const uint16_t pos = tail;
+  if (pos < head) {
+    if (head - pos <= size)
+      return nullptr;
+    tail = pos + size;
+    return queue + pos;
+  }
+
+  if (queueSize - pos > size || (queueSize - pos == size && head != 0)) {
+    tail = pos + size == queueSize ? 0 : pos + size;
+    return queue + pos;
+  }
+  if (head <= size)
     return nullptr;
+  if (queueSize - pos >= (uint16_t) sizeof(impl::QueuedCommand)) {
+    impl::QueuedCommand* skip = (impl::QueuedCommand*) (queue + pos);
+    skip->size = queueSize - pos;
+    skip->argCount = 0;
+    skip->flags = impl::QueuedCommand::Skip;
+  }
+  tail = size;
+  return queue;
+}
+
+// writes the record after tail and advances it, the record is not visible to poll
+// until queueTail is stored, returns false if the queue is full
+bool SerialCommands::enqueue(const Command& cmd, Arg* args, uint8_t argCount, uint8_t flags, uint16_t& tail) {
+  const uint16_t size = recordSize(args, argCount);
+  impl::QueuedCommand* record = (impl::QueuedCommand*) placeRecord(size, tail);
+  if (!record)
+    return false;
+  record->command = cmd;
+  record->size = size;
+  record->argCount = argCount;
+  record->flags = flags;
+
+  Arg* recordArgs = record->getArgs();
+  char* chars = (char*) (recordArgs + argCount);
+  for (uint8_t i = 0; i < argCount; ++i) {
+    memcpy(&recordArgs[i], &args[i], sizeof(Arg));
+    if (args[i].type == ArgType::String) {
+      uint16_t length = args[i].value.string.length;
+      memcpy(chars, args[i].value.string.chars, length);
+      chars[length] = '\0';
+      recordArgs[i].value.string.chars = chars;
+      chars += length + 1;
+    }
+  }
+  return true;
+}
+
+// the unterminated line was moved to the start of the buffer
+void SerialCommands::moveSlices(uint16_t offset) {
+  for (uint16_t i = 0; i < parser.argIndex; ++i) {
+    Arg& arg = args[i];
+    if (arg.isSlice()) {
+      arg.value.string.chars -= offset;
+    }
+  }
+}
+
+// Only the string arguments are copied, with their terminators, one after the other.
+// Slices that don't fit are terminated in the line, they are followed by a delimiter,
+// a quote or the end of the line, so the terminator doesn't touch the next slice.
+void SerialCommands::copyStrings() {
+  uint16_t used = 0;
+  for (uint16_t i = 0; i < parser.argIndex; ++i) {
+    Arg& arg = args[i];
+#if CMD_LAZY_ARGS
+    bool isString = arg.type == ArgType::String || (arg.state == Arg::State::Pending && arg.constraint->getType() == ArgType::String);
+#else
+    bool isString = arg.type == ArgType::String;
+#endif
+    if (!isString)
+      continue;
+    char* chars = const_cast<char*>(arg.value.string.chars);
+    uint16_t length = arg.value.string.length;
+    if (strings.getSize() - used > length) {
+      char* copy = strings.get(used);
+      memcpy(copy, chars, length);
+      used += length + 1;
+      chars = copy;
+    }
+    chars[length] = '\0';
+    arg.value.string.chars = chars;
+  }
+}
 
-  while (isDelim(*begin)) begin++;
+bool SerialCommands::runCommand(const Command& cmd, Args& args) {
+#if CMD_STATS
+  unsigned long start = micros();
+  cmd.runCommand(*this, args);
+  unsigned long duration = micros() - start;
+  stats.runTime.add(duration);
+  if (CommandStats* commandStats = findStats(cmd)) {
+    commandStats->calls++;
+    commandStats->runMicros += duration;
+  }
+#else
+  cmd.runCommand(*this, args);
+#endif
 
-  if (isQuotation(*begin)) {
-    const char quote = *begin;
-    begin++;
-    end = begin;
-    while (*end != quote && *end != '\0') end++;
+#if CMD_LAZY_ARGS
+  // report the first argument the command function failed to read
+  return args.getCount() == 0 || !printArgError(cmd, &args[0], args.getCount());
+#else
+  return true;
+#endif
+}
 
-    if (*end == quote) {
-      *end = '\0';
-      end++;
+#if CMD_LAZY_ARGS
+bool SerialCommands::printArgError(const Command& cmd, Arg* args, uint16_t argsCount) {
+  for (uint16_t i = 0; i < argsCount; ++i) {
+    if (args[i].state == Arg::State::ParseError) {
+      printParseError(i + 1, cmd);
+      return true;
+    }
+    if (args[i].state == Arg::State::RangeError) {
+      printRangeError(i + 1, *args[i].constraint, cmd);
+      return true;
     }
+  }
+  return false;
+}
+#endif
+
+void SerialCommands::printParseError(uint16_t argNumber, const Command& cmd) {
+#if CMD_STATS
+  if (CommandStats* commandStats = findStats(cmd)) {
+    commandStats->parseErrors++;
+  }
+#endif
+  if (errorFormat != ErrorFormat::Text) {
+    printError(FrameStatus::InvalidArgument, cmd, argNumber);
+    return;
+  }
+  serial.print(F("ERROR: Can't parse argument "));
+  serial.println(argNumber);
+  printCommand(cmd);
+  serial.println();
+}
+
+void SerialCommands::printRangeError(uint16_t argNumber, const impl::ArgConstraint& argc, const Command& cmd) {
+#if CMD_STATS
+  if (CommandStats* commandStats = findStats(cmd)) {
+    commandStats->rangeErrors++;
+  }
+#endif
+  if (errorFormat != ErrorFormat::Text) {
+    printError(FrameStatus::ArgumentOutOfRange, cmd, argNumber, &argc);
+    return;
+  }
+  serial.print(F("ERROR: Argument out of range "));
+  serial.print(argNumber);
+  Arg minimum = argc.getMinimum();
+  Arg maximum = argc.getMaximum();
+  serial.print(F(" ("));
+  if (minimum.getType() == ArgType::Float) {
+    serial.print(minimum.getFloat());
+    serial.print(F(" - "));
+    serial.print(maximum.getFloat());
   } else {
-    end = begin;
-    while (!isDelim(*end) && *end != '\0') end++;
+    serial.print(minimum.getInt());
+    serial.print(F(" - "));
+    serial.print(maximum.getInt());
   }
+  serial.println(')');
+  printCommand(cmd);
+  serial.println();
+}
 
-  while (isDelim(*end)) {
-    *end = '\0';
-    end++;
+// one line without the command syntax, fields that don't apply to the error are left out
+void SerialCommands::printError(FrameStatus code, const Command& cmd, uint16_t argNumber, const impl::ArgConstraint* argc) {
+  const bool json = errorFormat == ErrorFormat::Json;
+  serial.print(json ? F("{\"error\":") : F("E"));
+  serial.print((uint8_t) code);
+  if (cmd) {
+    serial.print(json ? F(",\"command\":[") : F(" "));
+    printCommandPath(cmd, json ? ',' : '.');
+    if (json) serial.print(']');
   }
+  if (argNumber) {
+    serial.print(json ? F(",\"arg\":") : F(" "));
+    serial.print(argNumber);
+  }
+  if (argc) {
+    Arg minimum = argc->getMinimum();
+    Arg maximum = argc->getMaximum();
+    serial.print(json ? F(",\"min\":") : F(" "));
+    if (minimum.getType() == ArgType::Float) {
+      serial.print(minimum.getFloat());
+      serial.print(json ? F(",\"max\":") : F(" "));
+      serial.print(maximum.getFloat());
+    } else {
+      serial.print(minimum.getInt());
+      serial.print(json ? F(",\"max\":") : F(" "));
+      serial.print(maximum.getInt());
+    }
+  }
+  if (json) serial.print('}');
+  serial.println();
+}
 
-  if (*end != '\0')
-    *stringp = end;
-  else
-    *stringp = nullptr;
+// indices of the command and its parents in their tables, starting at the top level
+void SerialCommands::printCommandPath(const Command& command, char separator) {
+  const Command* cmds = commands;
+  uint16_t cmdsCount = commandsCount;
+  Command parent = findParent(commands, commandsCount, command);
+  if (parent) {
+    printCommandPath(parent, separator);
+    serial.print(separator);
+    parent.getSubCommands(&cmds, &cmdsCount);
+  }
+  for (uint16_t i = 0; i < cmdsCount; ++i) {
+    if (getCommand(cmds, i) == command) {
+      serial.print(i);
+      return;
+    }
+  }
+}
+
+void SerialCommands::parseFrame(uint8_t* frame) {
+  uint8_t length = frame[1];
+  uint8_t* data = frame + 2;
+  uint8_t* const dataEnd = data + length;
+  uint8_t detail = 0;
 
-  return begin;
+  line = (const char*) frame;
+  lineLength = length + CMD_FRAME_OVERHEAD;
+
+  if (frame::crc16(frame + 1, length + 1) != ((uint16_t) dataEnd[0] << 8 | dataEnd[1])) {
+    writeFrame(FrameStatus::BadChecksum, nullptr, 0);
+    return;
+  }
+
+  uint16_t i;
+  uint8_t argCount;
+  uint16_t argIndex = 0;
+  Command cmd;
+  const Command* cmds = this->commands;
+  uint16_t cmdsCount = commandsCount;
+  FrameStatus status = FrameStatus::Ok;
+
+  // payload: command index followed by its packed arguments, for every level
+  while (data < dataEnd && status == FrameStatus::Ok) {
+    uint8_t cmdIndex = *data++;
+    if (cmds == nullptr) {
+      status = FrameStatus::TooManyArguments;
+      detail = argIndex + 1;
+      break;
+    }
+    if (cmdIndex >= cmdsCount) {
+      status = FrameStatus::UnknownCommand;
+      detail = cmdIndex;
+      break;
+    }
+    cmd = getCommand(cmds, cmdIndex);
+
+    const impl::ArgConstraint* argcs = cmd.getArgsPgm(&argCount);
+    uint8_t repeat = 0;
+    for (i = 0; i < argCount;) {
+      // a variadic argument takes the rest of the payload
+      if (repeat >= argcs[i].getMinCount() && data == dataEnd) {
+        i++;
+        repeat = 0;
+        continue;
+      }
+      ArgType type = argcs[i].getType();
+      detail = argIndex + 1;
+      if (argIndex == args.getSize()) {
+        status = FrameStatus::TooManyArguments;
+        break;
+      }
+      if (type == ArgType::String) {
+        const char* string = (const char*) data;
+        while (data < dataEnd && *data != '\0') data++;
+        if (data == dataEnd) {
+          status = FrameStatus::NotEnoughArguments;
+          break;
+        }
+        args[argIndex] = Arg(string, (const char*) data - string);
+        data++;
+      } else if (type == ArgType::Int || type == ArgType::Float) {
+        if (dataEnd - data < 4) {
+          status = FrameStatus::NotEnoughArguments;
+          break;
+        }
+        uint32_t value = frame::readUInt32(data);
+        data += 4;
+        if (type == ArgType::Int) {
+          args[argIndex] = Arg((int32_t) value);
+        } else {
+          float value_f;
+          memcpy(&value_f, &value, sizeof(value_f));
+          args[argIndex] = Arg(value_f);
+        }
+      } else {
+        status = FrameStatus::InvalidArgument;
+        break;
+      }
+
+      if (!argcs[i].isInRange(args[argIndex])) {
+        status = FrameStatus::ArgumentOutOfRange;
+#if CMD_STATS
+        if (CommandStats* commandStats = findStats(cmd)) {
+          commandStats->rangeErrors++;
+        }
+#endif
+        break;
+      }
+      argIndex++;
+      if (++repeat >= argcs[i].getMaxCount()) {
+        i++;
+        repeat = 0;
+      }
+    }
+    cmd.getSubCommands(&cmds, &cmdsCount);
+  }
+
+  if (status == FrameStatus::Ok && !cmd) {
+    status = FrameStatus::UnknownCommand;
+  }
+
+  if (status == FrameStatus::Ok && queue) {
+    // the Ok frame is sent when the command ran
+    uint16_t tail = queueTail;
+    if (enqueue(cmd, args.get(0), argIndex, impl::QueuedCommand::Frame, tail)) {
+      impl::storeIndex(&queueTail, tail);
+    } else {
+      writeFrame(FrameStatus::QueueFull, nullptr, 0);
+    }
+  } else if (status == FrameStatus::Ok) {
+    Args frameArgs(args.get(0), argIndex);
+    runCommand(cmd, frameArgs);
+    writeFrame(status, nullptr, 0);
+  } else {
+    writeFrame(status, &detail, 1);
+  }
 }
 
-bool SerialCommands::getArg(Arg& out, const char* string, const impl::ArgConstraint& arg) {
-  switch (arg.type) {
+void SerialCommands::writeFrame(FrameStatus status, const uint8_t* data, uint8_t length) {
+  uint8_t header[] = { frameSync, (uint8_t) (length + 1), (uint8_t) status };
+  uint16_t crc = frame::crc16(header + 1, 2);
+  crc = frame::crc16(data, length, crc);
+  uint8_t footer[] = { (uint8_t) (crc >> 8), (uint8_t) crc };
+  serial.write(header, sizeof(header));
+  serial.write(data, length);
+  serial.write(footer, sizeof(footer));
+}
+
+bool SerialCommands::getArg(Arg& out, const char* string, uint16_t length, ArgType type) {
+  switch (type) {
     case ArgType::String:
       {
-        out = Arg(string);
+        out = Arg(string, length);
         return true;
       }
     case ArgType::Int:
       {
         int32_t value;
-        if (parse::strtoi(string, &value)) {
+        if (parse::strtoi(string, length, &value)) {
           out = Arg(value);
           return true;
         }
@@ -233,7 +1449,7 @@ bool SerialCommands::getArg(Arg& out, const char* string, const impl::ArgConstra
     case ArgType::Float:
       {
         float value_f;
-        if (parse::strtof(string, &value_f)) {
+        if (parse::strtof(string, length, &value_f)) {
           out = Arg(value_f);
           return true;
         }
@@ -245,6 +1461,47 @@ bool SerialCommands::getArg(Arg& out, const char* string, const impl::ArgConstra
   return false;
 }
 
+#if CMD_LAZY_ARGS
+void Arg::convertToken() {
+  ArgType argType = constraint->getType();
+  const char* chars = value.string.chars;
+  uint16_t length = value.string.length;
+  bool parsed = false;
+  switch (argType) {
+    case ArgType::String:
+      parsed = true;
+      break;
+    case ArgType::Int:
+      parsed = parse::strtoi(chars, length, &value.num);
+      break;
+    case ArgType::Float:
+      parsed = parse::strtof(chars, length, &value.num_f);
+      break;
+    default:
+      break;
+  }
+
+  if (!parsed) {
+    value.num = 0;
+    state = State::ParseError;
+    return;
+  }
+
+  type = argType;
+  state = State::Valid;
+  if (!constraint->isInRange(*this)) {
+    // the command function gets the nearest bound instead of the value that was rejected
+    Arg minimum = constraint->getMinimum();
+    Arg maximum = constraint->getMaximum();
+    if (argType == ArgType::Float)
+      value.num_f = value.num_f < minimum.value.num_f ? minimum.value.num_f : maximum.value.num_f;
+    else
+      value.num = value.num < minimum.value.num ? minimum.value.num : maximum.value.num;
+    state = State::RangeError;
+  }
+}
+#endif
+
 void SerialCommands::printFromPgm(PGM_P str) {
   serial.print(reinterpret_cast<const __FlashStringHelper *>(str));
 }
\ No newline at end of file
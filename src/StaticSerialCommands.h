@@ -9,29 +9,160 @@ Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
 
 #include <Arduino.h>
 #include "Command.h"
+#include "CommandBuilder.h"
+#include "Frame.h"
+#include "BufferedStream.h"
+#include "Storage.h"
+#include "Stats.h"
+#include "Queue.h"
+#include "ReceiveRing.h"
+#include "PipelineStream.h"
 
-#define SERIAL_COMMANDS(serial, commands) SerialCommands(serial, commands, sizeof(commands) / sizeof(Command))
+// A line buffer of CMD_BUFFER_SIZE bytes for every expansion, the first object created by it
+// takes it for good. Further objects of the same expansion, e.g. in a helper function, get nullptr
+// and allocate their own buffer on the heap.
+#define CMD_LINE_BUFFER() ([]() -> char* { \
+    static char buffer[CMD_BUFFER_SIZE]; \
+    static bool taken = false; \
+    if (taken) return nullptr; \
+    taken = true; \
+    return buffer; }())
+
+#define SERIAL_COMMANDS(serial, commands) \
+  SerialCommands(serial, commands, sizeof(commands) / sizeof(Command), CMD_LINE_BUFFER(), CMD_BUFFER_SIZE)
+
+// The arguments of the longest path of a PGM_COMMAND_TABLE, a static array sized
+// at compile time from its footprint, taken like the buffer of CMD_LINE_BUFFER.
+#define CMD_PGM_ARGS(commands) ([]() -> impl::ArgsArray { \
+    static Arg args[impl::argsArraySize(commands##_footprint)]; \
+    static bool taken = false; \
+    if (taken) return impl::ArgsArray{ nullptr, 0 }; \
+    taken = true; \
+    return impl::ArgsArray{ args, sizeof(args) / sizeof(Arg) }; }())
+
+#define PGM_SERIAL_COMMANDS(serial, commands) \
+  SerialCommands(serial, PGM_COMMANDS(commands), CMD_LINE_BUFFER(), CMD_BUFFER_SIZE, CMD_PGM_ARGS(commands))
 
 #define CMD_DELIM ' '
 #define CMD_QUOTATION '"'
 #define CMD_TERM_1 '\n'
 #define CMD_TERM_2 '\r'
+#define CMD_BUFFER_SIZE 64
+#define CMD_MAX_BATCH 8
+#define CMD_XON 0x11
+#define CMD_XOFF 0x13
+#define CMD_FLOW_HIGH 75
+#define CMD_FLOW_LOW 25
+#define CMD_SCAN_COMMANDS 4
+#define CMD_STRINGS_SIZE 32
+
+// how readSerial reports errors, the codes are FrameStatus values
+enum class ErrorFormat : uint8_t {
+  Text,     // ERROR: Argument out of range 2 (0 - 255), followed by the command syntax
+  Compact,  // E4 1.0 2 0 255: code, command indices, argument number, range
+  Json      // {"error":4,"command":[1,0],"arg":2,"min":0,"max":255}
+};
+
+namespace impl {
+
+// a static array of arguments, see CMD_PGM_ARGS
+struct ArgsArray {
+  Arg* args;
+  uint8_t count;
+};
+
+// arguments are indexed with uint8_t, an empty array is one element
+constexpr uint8_t argsArraySize(const CommandFootprint& footprint) {
+  return footprint.maxArgs > UINT8_MAX ? UINT8_MAX : footprint.maxArgs > 0 ? footprint.maxArgs : 1;
+}
+
+constexpr uint8_t charBits(uint8_t) {
+  return 0;
+}
+
+// the bits of byte index of the set of the characters
+template<typename... Rest>
+constexpr uint8_t charBits(uint8_t index, char c, Rest... rest) {
+  return ((uint8_t) c >> 3 == index ? 1 << ((uint8_t) c & 7) : 0) | charBits(index, rest...);
+}
+
+template<typename Indices, char... chars>
+struct CharSetBits;
+
+template<size_t... indices, char... chars>
+struct CharSetBits<Indices<indices...>, chars...> {
+  static constexpr uint8_t bits[sizeof...(indices)] PROGMEM = { charBits(indices, chars...)... };
+};
+
+template<size_t... indices, char... chars>
+constexpr uint8_t CharSetBits<Indices<indices...>, chars...>::bits[sizeof...(indices)] PROGMEM;
+
+// a set of characters as a 256 bit table built at compile time,
+// a test reads one bit whatever the number of characters
+template<char... chars>
+struct CharSet : CharSetBits<MakeIndices<32>::type, chars...> {
+  static bool contains(char c) {
+    return pgm_read_byte(&CharSet::bits[(uint8_t) c >> 3]) & (1 << ((uint8_t) c & 7));
+  }
+};
+
+}
 
 class SerialCommands {
   public:
     typedef bool (*CharPredicate)(char);
+    typedef uint16_t (*CharScanner)(const char*, uint16_t, CharPredicate);
+    typedef void (*FlowCallback)(bool throttle);
 
     SerialCommands(Stream& serial, const Command* commands, uint16_t commandsCount, char* buffer, uint16_t bufferSize, uint16_t timeout = 0)
       : serial(serial), buffer(buffer), bufferSize(bufferSize),
         commands(commands), commandsCount(commandsCount),
-        timeout(timeout) {}
+        timeout(timeout) {
+      resetParser();
+    }
 
+    // Without a buffer the object allocates its own one of CMD_BUFFER_SIZE bytes on the heap
+    // on the first readSerial, as does a constructor that is given a nullptr buffer.
     SerialCommands(Stream& serial, const Command* commands, uint16_t commandsCount)
-      : serial(serial),
-        commands(commands), commandsCount(commandsCount), timeout(0) {
-      static char buffer[64];
-      this->buffer = buffer;
-      bufferSize = sizeof(buffer);
+      : SerialCommands(serial, commands, commandsCount, nullptr, CMD_BUFFER_SIZE) {}
+
+    // output is buffered and sent without blocking, see BufferedStream
+    SerialCommands(BufferedStream& serial, const Command* commands, uint16_t commandsCount, char* buffer, uint16_t bufferSize, uint16_t timeout = 0)
+      : SerialCommands((Stream&) serial, commands, commandsCount, buffer, bufferSize, timeout) {
+      output = &serial;
+    }
+
+    SerialCommands(BufferedStream& serial, const Command* commands, uint16_t commandsCount)
+      : SerialCommands(serial, commands, commandsCount, nullptr, CMD_BUFFER_SIZE) {}
+
+    // the command table and all subcommand tables are in program memory, see PGM_COMMAND
+    SerialCommands(Stream& serial, PgmCommands commands, char* buffer, uint16_t bufferSize, uint16_t timeout = 0)
+      : SerialCommands(serial, commands.commands, commands.count, buffer, bufferSize, timeout) {
+      pgmCommands = true;
+      indexed = true;
+    }
+
+    SerialCommands(Stream& serial, PgmCommands commands)
+      : SerialCommands(serial, commands, nullptr, CMD_BUFFER_SIZE) {}
+
+    // the arguments are the static array of CMD_PGM_ARGS instead of a heap array, see PGM_SERIAL_COMMANDS
+    SerialCommands(Stream& serial, PgmCommands commands, char* buffer, uint16_t bufferSize, impl::ArgsArray args, uint16_t timeout = 0)
+      : SerialCommands(serial, commands, buffer, bufferSize, timeout) {
+      this->args.assign(args.args, args.count);
+      staticArgs = this->args.getSize();
+    }
+
+    SerialCommands(BufferedStream& serial, PgmCommands commands, char* buffer, uint16_t bufferSize, uint16_t timeout = 0)
+      : SerialCommands((Stream&) serial, commands, buffer, bufferSize, timeout) {
+      output = &serial;
+    }
+
+    SerialCommands(BufferedStream& serial, PgmCommands commands)
+      : SerialCommands(serial, commands, nullptr, CMD_BUFFER_SIZE) {}
+
+    SerialCommands(BufferedStream& serial, PgmCommands commands, char* buffer, uint16_t bufferSize, impl::ArgsArray args, uint16_t timeout = 0)
+      : SerialCommands((Stream&) serial, commands, buffer, bufferSize, args, timeout) {
+      output = &serial;
     }
 
     void printCommand(const Command& command);
@@ -49,12 +180,151 @@ class SerialCommands {
       listAllCommands(commands, commandsCount);
     }
 
-    void readSerial();
+    // a table in program memory, see PGM_COMMAND_TABLE
+    void listCommands(PgmCommands commands) {
+      listCommands(commands.commands, commands.count);
+    }
+
+    void listAllCommands(PgmCommands commands) {
+      listAllCommands(commands.commands, commands.count);
+    }
+
+    // RAM used by an instance for a tree with the footprint, with the line buffer of bufferSize bytes,
+    // without a queue or the index of sortCommands, heap blocks count without the overhead of the allocator.
+    // A separator may make the arguments of a batch take more, see setSeparatorPredicate. The stack of the
+    // recursion over the levels of the tree is included, see CMD_LEVEL_STACK_BYTES, the handlers' isn't.
+    static constexpr uint32_t getRamBytes(const CommandFootprint& footprint, uint16_t bufferSize = CMD_BUFFER_SIZE) {
+      return sizeof(SerialCommands) + bufferSize
+             + (footprint.maxArgs > UINT8_MAX ? UINT8_MAX : footprint.maxArgs) * sizeof(Arg)
+             + (footprint.stringArgs ? (bufferSize < CMD_STRINGS_SIZE ? bufferSize : CMD_STRINGS_SIZE) : 0)
+             + footprint.depth * sizeof(ListLevel)
+             + footprint.getStackBytes()
+#if CMD_STATS
+             + footprint.commands * sizeof(impl::CommandStatsEntry)
+#endif
+             ;
+    }
+
+    // a listing prints at most lines lines per call, the rest is printed by the following
+    // calls of readSerial, or of poll if the queue is enabled, 0 prints a listing at once
+    void setListLines(uint8_t lines) {
+      listLines = lines;
+    }
+
+    bool isListing() {
+      return listDepth > listBase;
+    }
+
+    void readSerial() {
+      readSerial(UINT16_MAX);
+    }
+
+    void readSerial(uint16_t maxBytes);
+
+    void sortCommands();
+
+    void enableFrames(uint8_t sync = CMD_FRAME_SYNC) {
+      frameSync = sync;
+      framesEnabled = true;
+    }
+
+    void disableFrames() {
+      framesEnabled = false;
+    }
+
+    void sendFrame(const uint8_t* data, uint8_t length) {
+      writeFrame(FrameStatus::Data, data, length);
+    }
+
+    // readSerial reads the ring instead of the stream, nullptr reads the stream again,
+    // output is still written to the stream
+    void setReceiveRing(ReceiveRing* ring) {
+      this->ring = ring;
+    }
+
+    // readSerial only checks commands and copies them into the queue, poll runs them.
+    // readSerial and poll may run on different cores or threads, see PipelineStream.
+    void enableQueue(uint8_t* buffer, uint16_t size);
+
+    // queued commands are dropped, neither readSerial nor poll may be running
+    void disableQueue() {
+      queue = nullptr;
+      queueSize = queueHead = queueTail = 0;
+      step = 0;
+    }
+
+    bool isQueueEmpty() {
+      return impl::loadIndex(&queueHead) == impl::loadIndex(&queueTail);
+    }
+
+    // received lines wait in the line buffer until the queue has room for them
+    bool hasPendingLines() {
+      return unparsed;
+    }
+
+    // runs the first queued command, returns false if the queue is empty
+    bool poll();
+
+    // called by a queued command function to be called again with the same
+    // arguments on the next poll, getStep() returns the number of earlier calls
+    void runAgain() {
+      again = true;
+    }
+
+    uint16_t getStep() {
+      return step;
+    }
+
+    // The sender is throttled when the fill level reaches high percent and released at low percent,
+    // with XOFF and XON or by the callback, e.g. driving RTS. With the queue enabled readSerial
+    // stops reading while the queue has no room for a line, the line waits in the stream instead of being lost.
+    void enableFlowControl(FlowCallback callback = nullptr, uint8_t high = CMD_FLOW_HIGH, uint8_t low = CMD_FLOW_LOW) {
+      flowCallback = callback;
+      flowHigh = high;
+      flowLow = low;
+      flowControl = true;
+    }
+
+    // a throttled sender is released first
+    void disableFlowControl() {
+      if (throttled) setThrottled(false);
+      flowControl = false;
+    }
+
+    bool isThrottled() {
+      return throttled;
+    }
+
+    // percent of the fullest of the receive ring, the line buffer with the bytes
+    // waiting in the stream, and the queue
+    uint8_t getFillLevel();
+
+    // print a single "OK" after every command or batch that ran
+    void enableBatchStatus() {
+      batchStatus = true;
+    }
+
+    void disableBatchStatus() {
+      batchStatus = false;
+    }
+
+    // the command is given by its index in every level of the tree, as in frames
+    void setErrorFormat(ErrorFormat format) {
+      errorFormat = format;
+    }
 
     Stream& getSerial() {
       return serial;
     }
 
+    const char* getLine() {
+      return line;
+    }
+
+    uint16_t getLineLength() {
+      return lineLength;
+    }
+
     void setDelimiterPredicate(CharPredicate predicate) {
       isDelim = predicate;
     }
@@ -63,10 +333,38 @@ class SerialCommands {
       isQuotation = predicate;
     }
 
+    // batches need more argument storage, it is allocated again for the next line
+    void setSeparatorPredicate(CharPredicate predicate) {
+      isSeparator = predicate;
+      argsReserved = false;
+      resetParser();
+    }
+
     void setTerminationPredicate(CharPredicate predicate) {
       isTerm = predicate;
+      scanTerm = scanPredicate;
+    }
+
+#if CMD_STATS
+    const SerialStats& getStats() const {
+      return stats;
+    }
+
+    // nullptr before the first line arrived or if command is not in the table
+    const CommandStats* getStats(const Command& command) {
+      return findStats(command);
     }
 
+    void resetStats();
+    void printStats();
+
+    // command function that prints the statistics of the port that received it:
+    //   COMMAND(SerialCommands::statsCommand, "stats", nullptr, "print statistics")
+    static void statsCommand(SerialCommands& sender, Args&) {
+      sender.printStats();
+    }
+#endif
+
     template<char... chars>
     void setDelimiterChars() {
       isDelim = anyChar<chars...>;
@@ -77,41 +375,247 @@ class SerialCommands {
       isQuotation = anyChar<chars...>;
     }
 
+    template<char... chars>
+    void setSeparatorChars() {
+      setSeparatorPredicate(anyChar<chars...>);
+    }
+
     template<char... chars>
     void setTerminationChars() {
       isTerm = anyChar<chars...>;
+      scanTerm = scanChars<chars...>;
     }
 
   private:
     Stream& serial;
+    BufferedStream* output = nullptr;
+    ReceiveRing* ring = nullptr;
     char* buffer;
     uint16_t bufferSize;
     const Command* commands;
     const uint16_t commandsCount;
     const uint16_t timeout;
+    uint16_t index = 0;
+    unsigned long lastTime = 0;
+    bool discard = false;
+    bool unparsed = false;  // the buffer holds lines that wait for room in the queue
+    const char* line = nullptr;
+    uint16_t lineLength = 0;
+    bool pgmCommands = false;
+    bool indexed = false;
+    bool framesEnabled = false;
+    uint8_t frameSync = CMD_FRAME_SYNC;
+    bool batchStatus = false;
+    ErrorFormat errorFormat = ErrorFormat::Text;
+    bool flowControl = false;
+    bool throttled = false;
+    uint8_t flowHigh = CMD_FLOW_HIGH;
+    uint8_t flowLow = CMD_FLOW_LOW;
+    FlowCallback flowCallback = nullptr;
+
+    // the line being received is parsed as its bytes arrive,
+    // positions are relative to the start of the line
+    struct LineParser {
+      enum class Token : uint8_t { None, Unquoted, Quoted };
+      enum class Error : uint8_t { None, UnknownCommand, ParseError, RangeError, NotEnoughArguments, TooManyArguments, TooManyCommands };
+
+      uint16_t scanned = 0;  // bytes of the line fed so far
+      Token token = Token::None;
+      char quote = 0;
+      Error error = Error::None;
+      uint16_t tokenBegin = 0;
+      uint16_t tokenEnd = 0;
+      // matched command, the next name is one of cmds, indexBase is the start of their index in RAM
+      Command cmd;
+      const Command* cmds = nullptr;
+      uint16_t cmdsCount = 0;
+      uint16_t indexBase = 0;
+      // the trie node of a table in program memory that the command name reached, TrieDead if none,
+      // matched characters of the name and the name of the node's entry
+      uint16_t node = 0;
+      uint8_t matched = 0;
+      PGM_P nodeName = nullptr;
+      const impl::ArgConstraint* argcs = nullptr;
+      uint8_t argCount = 0;
+      uint8_t argPos = 0;
+      uint8_t repeat = 0;     // arguments taken by argcs[argPos] so far
+      uint16_t argFirst = 0;  // first argument of cmd
+      uint16_t argIndex = 0;
+      // commands of the line that are validated, run when the line ends
+      uint8_t batchCount = 0;
+      Command batch[CMD_MAX_BATCH];
+      uint8_t batchFirst[CMD_MAX_BATCH];
+#if CMD_STATS
+      unsigned long parseMicros = 0;
+#endif
+    } parser;
+
+    // the line buffer of an object that wasn't given one
+    impl::Storage<char> lineBuffer;
+    // arguments of the line, a batch stores the arguments of its commands one after the other
+    impl::Storage<Arg> args;
+    // the arguments of the longest path, known at compile time with CMD_PGM_ARGS, 0 without it
+    uint8_t staticArgs = 0;
+    bool argsReserved = false;
+    // terminated copies of the string arguments of a line one after the other,
+    // allocated with the arguments if the tree has string arguments
+    impl::Storage<char> strings;
+
+    // a table of the listing in progress and its current command
+    struct ListLevel {
+      const Command* commands;
+      uint16_t count;
+      uint16_t index;
+    };
+
+    // one level per level of the tree, the levels below listBase are the parents of the listed table
+    impl::Storage<ListLevel> listStack;
+
+    // the i-th entry of the index of a table in RAM, see sortCommands
+    struct IndexEntry {
+      uint16_t entry;        // position in the table of the i-th command in the order of the names
+      uint16_t subcommands;  // start of the index of the subcommands of the command at position i
+    };
+
+    // the tables of the tree one after the other, depth first
+    impl::Storage<IndexEntry> nameIndex;
+    uint8_t listDepth = 0;
+    uint8_t listBase = 0;
+    uint8_t listLines = 0;
+    bool listAll = false;
+
+    // queued commands are in [queueHead, queueTail), wrapping around the end of the buffer.
+    // readSerial writes only the tail and poll only the head, so they can run concurrently.
+    uint8_t* queue = nullptr;
+    uint16_t queueSize = 0;
+    uint16_t queueHead = 0;
+    uint16_t queueTail = 0;
+    uint16_t step = 0;
+    bool again = false;
+
+#if CMD_STATS
+    SerialStats stats;
+    impl::Storage<impl::CommandStatsEntry> commandStats;
+#endif
 
     CharPredicate isDelim = [](char c) { return c == CMD_DELIM; };
     CharPredicate isQuotation = [](char c) { return c == CMD_QUOTATION; };
+    CharPredicate isSeparator = nullptr;
     CharPredicate isTerm = [](char c) { return c == CMD_TERM_1 || c == CMD_TERM_2; };
+    CharScanner scanTerm = scanChars<CMD_TERM_1, CMD_TERM_2>;
+
+    Command getCommand(const Command* commands, uint16_t index) {
+      return pgmCommands ? Command::readPgm(&commands[index]) : commands[index];
+    }
+
+    Command findParent(const Command* commands, uint16_t commandsCount, const Command& command);
+    void printCommandSyntax(const Command& command);
+
+    void startListing(const Command* commands, uint16_t commandsCount, bool all);
+    bool findTable(const Command* table);
+    bool enterSubcommands(const Command& command);
+    void continueListing();
+    void listNext();
+    uint8_t countLevels(const Command* commands, uint16_t commandsCount);
+
+    uint16_t indexTable(const Command* commands, uint16_t commandsCount, uint16_t& next);
+    uint16_t countCommands(const Command* commands, uint16_t commandsCount);
+    static int comparePgm(PGM_P a, PGM_P b);
+    static int compareToken(const char* token, uint16_t len, PGM_P name);
+
+    Command findCommand(const char* const string, uint16_t len, const Command* commands, uint16_t commandsCount, uint16_t& position);
+    uint16_t indexedEntry(uint16_t rank);
+    bool trieToken();
+    void startCommand();
+    void narrowCommand(const char* chars, uint16_t count);
+    Command trieCommand(uint16_t& position);
+    Command searchCommand(const char* token, uint16_t len, uint16_t& position);
+
+    void reserveArgs();
+    uint16_t countArgs(const Command* commands, uint16_t commandsCount);
+    bool hasStringArgs(const Command* commands, uint16_t commandsCount);
+    void copyStrings();
+
+#if CMD_STATS
+    void reserveStats();
+    void collectCommands(const Command* commands, uint16_t commandsCount, uint16_t& index);
+    CommandStats* findStats(const Command& command);
+    void printStats(const Command* commands, uint16_t commandsCount);
+    void printHistogram(const TimeHistogram& histogram);
+#endif
+
+    void resetParser();
+    void feedParser(const char* line, uint16_t length);
+    void endToken(const char* line, uint16_t end);
+    void closeCommand(const char* line, uint16_t end);
+    void finishLine(const char* line, uint16_t length);
+    void moveSlices(uint16_t offset);
 
-    const Command* findCommand(const char* const string, const Command* commands, uint16_t commandsCount);
-    void parseCommand(char* string);
+    void parseFrame(uint8_t* frame);
+    bool runCommand(const Command& cmd, Args& args);
+    void runBatch();
+    static uint16_t recordSize(Arg* args, uint8_t argCount);
+    bool isQueueBlocked();
+    uint16_t lineRecordsSize();
+    bool hasQueueRoom(uint16_t size);
+    void updateFlow();
+    void setThrottled(bool throttle);
+    uint8_t* placeRecord(uint16_t size, uint16_t& tail);
+    bool enqueue(const Command& cmd, Arg* args, uint8_t argCount, uint8_t flags, uint16_t& tail);
+#if CMD_LAZY_ARGS
+    bool printArgError(const Command& cmd, Arg* args, uint16_t argsCount);
+#endif
 
-    char* getToken(char** stringp);
+    void printParseError(uint16_t argNumber, const Command& cmd);
+    void printRangeError(uint16_t argNumber, const impl::ArgConstraint& argc, const Command& cmd);
+    void printError(FrameStatus code, const Command& cmd = Command(), uint16_t argNumber = 0, const impl::ArgConstraint* argc = nullptr);
+    void printCommandPath(const Command& command, char separator);
 
-    bool getArg(Arg& out, const char* string, const impl::ArgConstraint& arg);
+    void writeFrame(FrameStatus status, const uint8_t* data, uint8_t length);
+
+    bool getArg(Arg& out, const char* string, uint16_t length, ArgType type);
 
     void printFromPgm(PGM_P str);
 
     template<char... chars>
     static bool anyChar(char c) {
-      //return ((c == chars) || ...);
-      char arr[] = { chars... };
-      for (auto ch : arr) {
-        if (c == ch) return true;
+      return impl::CharSet<chars...>::contains(c);
+    }
+
+    // returns the index of the first matching character or len if there is none
+    template<char... chars>
+    static uint16_t scanChars(const char* str, uint16_t len, CharPredicate) {
+      uint16_t i = 0;
+      while (i < len && !impl::CharSet<chars...>::contains(str[i])) i++;
+      return i;
+    }
+
+    static uint16_t scanPredicate(const char* str, uint16_t len, CharPredicate predicate) {
+      uint16_t i = 0;
+      while (i < len && !predicate(str[i])) i++;
+      return i;
+    }
+};
+
+class SerialCommandsGroup {
+  public:
+    SerialCommandsGroup(SerialCommands* ports, uint8_t portsCount, uint16_t budget = CMD_BUFFER_SIZE)
+      : ports(ports), portsCount(portsCount), budget(budget) {}
+
+    void readSerial();
+
+    // runs one queued command of every port
+    void poll() {
+      for (uint8_t i = 0; i < portsCount; ++i) {
+        ports[i].poll();
       }
-      return false;
     }
+
+  private:
+    SerialCommands* ports;
+    const uint8_t portsCount;
+    const uint16_t budget;
+    uint8_t first = 0;
 };
 
 #endif // STATIC_SERIAL_COMMANDS_H
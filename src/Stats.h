@@ -0,0 +1,62 @@
+/*---------------------------------------------------------------------
+Author         : naszly
+License        : BSD
+Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
+-----------------------------------------------------------------------*/
+
+#ifndef STATIC_SERIAL_COMMANDS_STATS_H
+#define STATIC_SERIAL_COMMANDS_STATS_H
+
+#include <Arduino.h>
+
+// 1: commands are counted and timed, see SerialCommands::printStats
+// 0: no statistics, nothing is stored
+#ifndef CMD_STATS
+#define CMD_STATS 0
+#endif
+
+#define CMD_STATS_BUCKETS 12
+
+#if CMD_STATS
+
+struct CommandStats {
+  uint32_t calls = 0;
+  uint32_t runMicros = 0;  // total time spent in the command function
+  uint16_t parseErrors = 0;
+  uint16_t rangeErrors = 0;
+};
+
+// bucket i counts durations below 2^(i + 1) microseconds, the last bucket counts the rest
+struct TimeHistogram {
+  uint16_t counts[CMD_STATS_BUCKETS] = {};
+
+  void add(unsigned long micros) {
+    uint8_t i = 0;
+    while (i < CMD_STATS_BUCKETS - 1 && (micros >> (i + 1)) != 0) i++;
+    if (counts[i] != UINT16_MAX) counts[i]++;
+  }
+};
+
+struct SerialStats {
+  uint32_t lines = 0;
+  uint16_t unknownCommands = 0;
+  uint16_t argumentCountErrors = 0;  // not enough or too many arguments
+  uint16_t overflows = 0;
+  uint16_t bufferHighWater = 0;      // most bytes waiting in the receive buffer
+  TimeHistogram parseTime;           // per line, without the command functions
+  TimeHistogram runTime;             // per command function call
+};
+
+namespace impl {
+
+// sorted by command address
+struct CommandStatsEntry {
+  const void* command = nullptr;
+  CommandStats stats;
+};
+
+}
+
+#endif
+
+#endif // STATIC_SERIAL_COMMANDS_STATS_H
@@ -0,0 +1,83 @@
+/*---------------------------------------------------------------------
+Author         : naszly
+License        : BSD
+Repository     : https://github.com/naszly/Arduino-StaticSerialCommands
+-----------------------------------------------------------------------*/
+
+#ifndef STATIC_SERIAL_COMMANDS_STORAGE_H
+#define STATIC_SERIAL_COMMANDS_STORAGE_H
+
+#include <Arduino.h>
+
+namespace impl {
+
+// array owned by a SerialCommands object, it is allocated on the heap once
+// when the size is known from the command table. calloc is used instead of new,
+// its result can be checked on cores built without -fcheck-new, and zeroed
+// memory is a valid default value of every element type. If the heap is
+// exhausted the array stays empty and isAllocated() returns false.
+// An array given with assign, e.g. a static one sized at compile time, is used instead and never freed.
+template<typename T>
+class Storage {
+  public:
+    Storage() = default;
+
+    Storage(Storage&& other)
+      : data(other.data), size(other.size), owned(other.owned) {
+      other.data = nullptr;
+      other.size = 0;
+    }
+
+    Storage(const Storage&) = delete;
+    Storage& operator=(const Storage&) = delete;
+
+    ~Storage() {
+      if (owned) free(data);
+    }
+
+    bool isAllocated() const {
+      return data != nullptr;
+    }
+
+    void allocate(uint16_t count) {
+      release();
+      // an empty array is allocated as one element, so that it counts as allocated
+      data = (T*) calloc(count > 0 ? count : 1, sizeof(T));
+      size = data ? count : 0;
+    }
+
+    void release() {
+      if (owned) free(data);
+      data = nullptr;
+      size = 0;
+      owned = true;
+    }
+
+    void assign(T* array, uint16_t count) {
+      release();
+      data = array;
+      size = array ? count : 0;
+      owned = false;
+    }
+
+    T& operator[](uint16_t idx) {
+      return data[idx];
+    }
+
+    T* get(uint16_t first) {
+      return data + first;
+    }
+
+    uint16_t getSize() const {
+      return size;
+    }
+
+  private:
+    T* data = nullptr;
+    uint16_t size = 0;
+    bool owned = true;
+};
+
+}
+
+#endif // STATIC_SERIAL_COMMANDS_STORAGE_H